@@ -0,0 +1,441 @@
+// Synthetic FMI 3.0 models used by liaison_bench. The model is selected at
+// compile time:
+//
+//   SYNTHETIC_N_VARIABLES  number of input variables of each type (0: no-op model)
+//   SYNTHETIC_BUSY         adds busy time per step and sized String/Binary outputs
+//
+// The value reference of variable i of type t is (t + 1) * VR_BLOCK + i. The
+// variables of the busy model use the value references below VR_BLOCK.
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fmi3Functions.h"
+
+#ifndef SYNTHETIC_N_VARIABLES
+#define SYNTHETIC_N_VARIABLES 0
+#endif
+
+#ifndef SYNTHETIC_BUSY
+#define SYNTHETIC_BUSY 0
+#endif
+
+#define VR_BLOCK 1000000
+#define N_SLOTS (SYNTHETIC_N_VARIABLES > 0 ? SYNTHETIC_N_VARIABLES : 1)
+
+#define VR_BUSY_TIME 1
+#define VR_STRING_SIZE 2
+#define VR_BINARY_SIZE 3
+#define VR_STRING 4
+#define VR_BINARY 5
+#define VR_STEPS 6
+
+enum {
+    TYPE_FLOAT32,
+    TYPE_FLOAT64,
+    TYPE_INT8,
+    TYPE_UINT8,
+    TYPE_INT16,
+    TYPE_UINT16,
+    TYPE_INT32,
+    TYPE_UINT32,
+    TYPE_INT64,
+    TYPE_UINT64,
+    TYPE_BOOLEAN,
+    TYPE_STRING,
+    TYPE_BINARY
+};
+
+typedef struct {
+    fmi3InstanceEnvironment instanceEnvironment;
+    fmi3LogMessageCallback logMessage;
+    fmi3Float64 time;
+
+    fmi3Float32 float32Values[N_SLOTS];
+    fmi3Float64 float64Values[N_SLOTS];
+    fmi3Int8 int8Values[N_SLOTS];
+    fmi3UInt8 uint8Values[N_SLOTS];
+    fmi3Int16 int16Values[N_SLOTS];
+    fmi3UInt16 uint16Values[N_SLOTS];
+    fmi3Int32 int32Values[N_SLOTS];
+    fmi3UInt32 uint32Values[N_SLOTS];
+    fmi3Int64 int64Values[N_SLOTS];
+    fmi3UInt64 uint64Values[N_SLOTS];
+    fmi3Boolean booleanValues[N_SLOTS];
+    char* stringValues[N_SLOTS];
+    fmi3Byte* binaryValues[N_SLOTS];
+    size_t binarySizes[N_SLOTS];
+
+    fmi3Float64 busyTime;
+    fmi3UInt64 stringSize;
+    fmi3UInt64 binarySize;
+    char* string;
+    fmi3Byte* binary;
+    size_t stringCapacity;
+    size_t binaryCapacity;
+    fmi3UInt64 steps;
+} Instance;
+
+static char* copyString(const char* value) {
+    size_t size = strlen(value) + 1;
+    char* copy = (char*)malloc(size);
+    memcpy(copy, value, size);
+    return copy;
+}
+
+static void resetInstance(Instance* instance) {
+    instance->time = 0;
+    for (size_t i = 0; i < N_SLOTS; ++i) {
+        instance->float32Values[i] = 0;
+        instance->float64Values[i] = 0;
+        instance->int8Values[i] = 0;
+        instance->uint8Values[i] = 0;
+        instance->int16Values[i] = 0;
+        instance->uint16Values[i] = 0;
+        instance->int32Values[i] = 0;
+        instance->uint32Values[i] = 0;
+        instance->int64Values[i] = 0;
+        instance->uint64Values[i] = 0;
+        instance->booleanValues[i] = fmi3False;
+        free(instance->stringValues[i]);
+        instance->stringValues[i] = copyString("");
+        free(instance->binaryValues[i]);
+        instance->binaryValues[i] = NULL;
+        instance->binarySizes[i] = 0;
+    }
+    instance->busyTime = 0;
+    instance->stringSize = 0;
+    instance->binarySize = 0;
+    instance->steps = 0;
+}
+
+// Index of a generated variable of the given type, or -1.
+static long variableIndex(fmi3ValueReference valueReference, int type) {
+    if (valueReference / VR_BLOCK != (fmi3ValueReference)(type + 1)) {
+        return -1;
+    }
+    long index = (long)(valueReference % VR_BLOCK);
+    return index < SYNTHETIC_N_VARIABLES ? index : -1;
+}
+
+#if SYNTHETIC_BUSY
+// The String and Binary outputs follow the sizes set on their inputs. They are
+// filled with a byte that changes at every step.
+static void updateOutputs(Instance* instance) {
+    if (!instance->string || instance->stringCapacity < instance->stringSize + 1) {
+        free(instance->string);
+        instance->stringCapacity = instance->stringSize + 1;
+        instance->string = (char*)malloc(instance->stringCapacity);
+    }
+    if (!instance->binary || instance->binaryCapacity < instance->binarySize) {
+        free(instance->binary);
+        instance->binaryCapacity = instance->binarySize > 0 ? instance->binarySize : 1;
+        instance->binary = (fmi3Byte*)malloc(instance->binaryCapacity);
+    }
+    memset(instance->string, 'a' + (int)(instance->steps % 26), instance->stringSize);
+    instance->string[instance->stringSize] = '\0';
+    memset(instance->binary, (int)(instance->steps & 0xff), instance->binarySize);
+}
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+#endif
+
+static void* instantiate(fmi3InstanceEnvironment instanceEnvironment, fmi3LogMessageCallback logMessage) {
+    Instance* instance = (Instance*)calloc(1, sizeof(Instance));
+    if (!instance) {
+        return NULL;
+    }
+    instance->instanceEnvironment = instanceEnvironment;
+    instance->logMessage = logMessage;
+    resetInstance(instance);
+    return instance;
+}
+
+
+// Inquire version numbers and set debug logging
+
+const char* fmi3GetVersion(void) {
+    return fmi3Version;
+}
+
+fmi3Status fmi3SetDebugLogging(fmi3Instance instance, fmi3Boolean loggingOn, size_t nCategories, const fmi3String categories[]) {
+    return fmi3OK;
+}
+
+
+// Creation and destruction of FMU instances
+
+fmi3Instance fmi3InstantiateModelExchange(
+    fmi3String instanceName,
+    fmi3String instantiationToken,
+    fmi3String resourcePath,
+    fmi3Boolean visible,
+    fmi3Boolean loggingOn,
+    fmi3InstanceEnvironment instanceEnvironment,
+    fmi3LogMessageCallback logMessage) {
+    return instantiate(instanceEnvironment, logMessage);
+}
+
+fmi3Instance fmi3InstantiateCoSimulation(
+    fmi3String instanceName,
+    fmi3String instantiationToken,
+    fmi3String resourcePath,
+    fmi3Boolean visible,
+    fmi3Boolean loggingOn,
+    fmi3Boolean eventModeUsed,
+    fmi3Boolean earlyReturnAllowed,
+    const fmi3ValueReference requiredIntermediateVariables[],
+    size_t nRequiredIntermediateVariables,
+    fmi3InstanceEnvironment instanceEnvironment,
+    fmi3LogMessageCallback logMessage,
+    fmi3IntermediateUpdateCallback intermediateUpdate) {
+    return instantiate(instanceEnvironment, logMessage);
+}
+
+fmi3Instance fmi3InstantiateScheduledExecution(
+    fmi3String instanceName,
+    fmi3String instantiationToken,
+    fmi3String resourcePath,
+    fmi3Boolean visible,
+    fmi3Boolean loggingOn,
+    fmi3InstanceEnvironment instanceEnvironment,
+    fmi3LogMessageCallback logMessage,
+    fmi3ClockUpdateCallback clockUpdate,
+    fmi3LockPreemptionCallback lockPreemption,
+    fmi3UnlockPreemptionCallback unlockPreemption) {
+    return instantiate(instanceEnvironment, logMessage);
+}
+
+void fmi3FreeInstance(fmi3Instance instance) {
+    Instance* self = (Instance*)instance;
+    if (!self) {
+        return;
+    }
+    for (size_t i = 0; i < N_SLOTS; ++i) {
+        free(self->stringValues[i]);
+        free(self->binaryValues[i]);
+    }
+    free(self->string);
+    free(self->binary);
+    free(self);
+}
+
+
+// Enter and exit initialization mode, terminate and reset
+
+fmi3Status fmi3EnterInitializationMode(
+    fmi3Instance instance,
+    fmi3Boolean toleranceDefined,
+    fmi3Float64 tolerance,
+    fmi3Float64 startTime,
+    fmi3Boolean stopTimeDefined,
+    fmi3Float64 stopTime) {
+    ((Instance*)instance)->time = startTime;
+    return fmi3OK;
+}
+
+fmi3Status fmi3ExitInitializationMode(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3EnterEventMode(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3Terminate(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3Reset(fmi3Instance instance) {
+    resetInstance((Instance*)instance);
+    return fmi3OK;
+}
+
+
+// Getting and setting variable values
+
+#define DEFINE_GET_SET(TYPE, FIELD, TYPE_ID, BUSY_CASES) \
+fmi3Status fmi3Get##TYPE(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3##TYPE values[], size_t nValues) { \
+    Instance* self = (Instance*)instance; \
+    if (nValues < nValueReferences) { \
+        return fmi3Error; \
+    } \
+    for (size_t i = 0; i < nValueReferences; ++i) { \
+        long index = variableIndex(valueReferences[i], TYPE_ID); \
+        if (index >= 0) { \
+            values[i] = self->FIELD[index]; \
+            continue; \
+        } \
+        switch (valueReferences[i]) { \
+            BUSY_CASES(values[i] =, ) \
+            default: return fmi3Error; \
+        } \
+    } \
+    return fmi3OK; \
+} \
+\
+fmi3Status fmi3Set##TYPE(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3##TYPE values[], size_t nValues) { \
+    Instance* self = (Instance*)instance; \
+    if (nValues < nValueReferences) { \
+        return fmi3Error; \
+    } \
+    for (size_t i = 0; i < nValueReferences; ++i) { \
+        long index = variableIndex(valueReferences[i], TYPE_ID); \
+        if (index >= 0) { \
+            self->FIELD[index] = values[i]; \
+            continue; \
+        } \
+        switch (valueReferences[i]) { \
+            BUSY_CASES(, = values[i]) \
+            default: return fmi3Error; \
+        } \
+    } \
+    return fmi3OK; \
+}
+
+#define NO_BUSY_CASES(GET, SET)
+
+#if SYNTHETIC_BUSY
+#define FLOAT64_BUSY_CASES(GET, SET) case VR_BUSY_TIME: GET self->busyTime SET; break;
+#define UINT64_BUSY_CASES(GET, SET) \
+    case VR_STRING_SIZE: GET self->stringSize SET; break; \
+    case VR_BINARY_SIZE: GET self->binarySize SET; break; \
+    case VR_STEPS: GET self->steps SET; break;
+#else
+#define FLOAT64_BUSY_CASES NO_BUSY_CASES
+#define UINT64_BUSY_CASES NO_BUSY_CASES
+#endif
+
+DEFINE_GET_SET(Float32, float32Values, TYPE_FLOAT32, NO_BUSY_CASES)
+DEFINE_GET_SET(Float64, float64Values, TYPE_FLOAT64, FLOAT64_BUSY_CASES)
+DEFINE_GET_SET(Int8, int8Values, TYPE_INT8, NO_BUSY_CASES)
+DEFINE_GET_SET(UInt8, uint8Values, TYPE_UINT8, NO_BUSY_CASES)
+DEFINE_GET_SET(Int16, int16Values, TYPE_INT16, NO_BUSY_CASES)
+DEFINE_GET_SET(UInt16, uint16Values, TYPE_UINT16, NO_BUSY_CASES)
+DEFINE_GET_SET(Int32, int32Values, TYPE_INT32, NO_BUSY_CASES)
+DEFINE_GET_SET(UInt32, uint32Values, TYPE_UINT32, NO_BUSY_CASES)
+DEFINE_GET_SET(Int64, int64Values, TYPE_INT64, NO_BUSY_CASES)
+DEFINE_GET_SET(UInt64, uint64Values, TYPE_UINT64, UINT64_BUSY_CASES)
+DEFINE_GET_SET(Boolean, booleanValues, TYPE_BOOLEAN, NO_BUSY_CASES)
+
+fmi3Status fmi3GetString(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3String values[], size_t nValues) {
+    Instance* self = (Instance*)instance;
+    if (nValues < nValueReferences) {
+        return fmi3Error;
+    }
+    for (size_t i = 0; i < nValueReferences; ++i) {
+        long index = variableIndex(valueReferences[i], TYPE_STRING);
+        if (index >= 0) {
+            values[i] = self->stringValues[index];
+#if SYNTHETIC_BUSY
+        } else if (valueReferences[i] == VR_STRING) {
+            updateOutputs(self);
+            values[i] = self->string;
+#endif
+        } else {
+            return fmi3Error;
+        }
+    }
+    return fmi3OK;
+}
+
+fmi3Status fmi3SetString(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3String values[], size_t nValues) {
+    Instance* self = (Instance*)instance;
+    if (nValues < nValueReferences) {
+        return fmi3Error;
+    }
+    for (size_t i = 0; i < nValueReferences; ++i) {
+        long index = variableIndex(valueReferences[i], TYPE_STRING);
+        if (index < 0) {
+            return fmi3Error;
+        }
+        free(self->stringValues[index]);
+        self->stringValues[index] = copyString(values[i]);
+    }
+    return fmi3OK;
+}
+
+fmi3Status fmi3GetBinary(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, size_t valueSizes[], fmi3Binary values[], size_t nValues) {
+    Instance* self = (Instance*)instance;
+    if (nValues < nValueReferences) {
+        return fmi3Error;
+    }
+    for (size_t i = 0; i < nValueReferences; ++i) {
+        long index = variableIndex(valueReferences[i], TYPE_BINARY);
+        if (index >= 0) {
+            values[i] = self->binaryValues[index];
+            valueSizes[i] = self->binarySizes[index];
+#if SYNTHETIC_BUSY
+        } else if (valueReferences[i] == VR_BINARY) {
+            updateOutputs(self);
+            values[i] = self->binary;
+            valueSizes[i] = self->binarySize;
+#endif
+        } else {
+            return fmi3Error;
+        }
+    }
+    return fmi3OK;
+}
+
+fmi3Status fmi3SetBinary(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const size_t valueSizes[], const fmi3Binary values[], size_t nValues) {
+    Instance* self = (Instance*)instance;
+    if (nValues < nValueReferences) {
+        return fmi3Error;
+    }
+    for (size_t i = 0; i < nValueReferences; ++i) {
+        long index = variableIndex(valueReferences[i], TYPE_BINARY);
+        if (index < 0) {
+            return fmi3Error;
+        }
+        free(self->binaryValues[index]);
+        self->binaryValues[index] = (fmi3Byte*)malloc(valueSizes[i] > 0 ? valueSizes[i] : 1);
+        memcpy(self->binaryValues[index], values[i], valueSizes[i]);
+        self->binarySizes[index] = valueSizes[i];
+    }
+    return fmi3OK;
+}
+
+fmi3Status fmi3GetClock(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3Clock values[]) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3SetClock(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3Clock values[]) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+
+// Co-Simulation
+
+fmi3Status fmi3DoStep(
+    fmi3Instance instance,
+    fmi3Float64 currentCommunicationPoint,
+    fmi3Float64 communicationStepSize,
+    fmi3Boolean noSetFMUStatePriorToCurrentPoint,
+    fmi3Boolean* eventHandlingNeeded,
+    fmi3Boolean* terminateSimulation,
+    fmi3Boolean* earlyReturn,
+    fmi3Float64* lastSuccessfulTime) {
+    Instance* self = (Instance*)instance;
+
+#if SYNTHETIC_BUSY
+    if (self->busyTime > 0) {
+        double end = seconds() + self->busyTime;
+        while (seconds() < end) {
+        }
+    }
+    self->steps++;
+#endif
+
+    self->time = currentCommunicationPoint + communicationStepSize;
+    *eventHandlingNeeded = fmi3False;
+    *terminateSimulation = fmi3False;
+    *earlyReturn = fmi3False;
+    *lastSuccessfulTime = self->time;
+    return fmi3OK;
+}
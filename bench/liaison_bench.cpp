@@ -0,0 +1,728 @@
+// Benchmark of FMI calls through the Liaison FMU and a local Liaison server.
+//
+// The synthetic FMUs are served by 'liaison --serve' over loopback. Each case
+// is run twice: against the original FMU loaded in-process, and against the
+// Liaison FMU. The latency percentiles and the calls per second of both runs
+// are written as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+#include "fmi3FunctionTypes.h"
+#include "liaisonBatch.h"
+#include "stats.hpp"
+
+using json = nlohmann::json;
+
+#define VR_BLOCK 1000000
+#define ENSEMBLE_SIZE 64
+
+#define FOR_EACH_NUMERIC_TYPE(X) \
+    X(Float32, 0) \
+    X(Float64, 1) \
+    X(Int8, 2) \
+    X(UInt8, 3) \
+    X(Int16, 4) \
+    X(UInt16, 5) \
+    X(Int32, 6) \
+    X(UInt32, 7) \
+    X(Int64, 8) \
+    X(UInt64, 9) \
+    X(Boolean, 10)
+
+#define TYPE_INDEX_STRING 11
+#define TYPE_INDEX_BINARY 12
+
+// Value references of the busy model (see fmus/synthetic.c)
+#define VR_BUSY_TIME 1
+#define VR_STRING_SIZE 2
+#define VR_BINARY_SIZE 3
+#define VR_STRING 4
+#define VR_BINARY 5
+
+
+struct Options {
+    size_t iterations = 1000;
+    size_t warmup = 100;
+    size_t workers = 0;
+    int port = 7448;
+    std::string encoding = "compact";
+    bool binary = true;
+    bool localRealTime = false;
+    std::string output = "liaison_bench.json";
+    std::string server = LIAISON_BENCH_SERVER;
+    std::string client = LIAISON_BENCH_CLIENT;
+    std::string fmuDirectory = LIAISON_BENCH_FMU_DIR;
+};
+
+
+// FMI functions used by the benchmark, resolved from a shared library.
+struct FmuApi {
+    void* library = nullptr;
+    fmi3InstantiateCoSimulationTYPE* fmi3InstantiateCoSimulation = nullptr;
+    fmi3FreeInstanceTYPE* fmi3FreeInstance = nullptr;
+    fmi3EnterInitializationModeTYPE* fmi3EnterInitializationMode = nullptr;
+    fmi3ExitInitializationModeTYPE* fmi3ExitInitializationMode = nullptr;
+    fmi3TerminateTYPE* fmi3Terminate = nullptr;
+    fmi3DoStepTYPE* fmi3DoStep = nullptr;
+    liaisonDoStepBatchTYPE* liaisonDoStepBatch = nullptr; // Liaison FMU only
+#define DECLARE_GET_SET(NAME, INDEX) \
+    fmi3Get##NAME##TYPE* fmi3Get##NAME = nullptr; \
+    fmi3Set##NAME##TYPE* fmi3Set##NAME = nullptr;
+    FOR_EACH_NUMERIC_TYPE(DECLARE_GET_SET)
+    DECLARE_GET_SET(String, TYPE_INDEX_STRING)
+    DECLARE_GET_SET(Binary, TYPE_INDEX_BINARY)
+#undef DECLARE_GET_SET
+};
+
+#define LOAD_FUNCTION(F, API, PATH) \
+    API.F = reinterpret_cast<F##TYPE*>(dlsym(API.library, #F)); \
+    if (!API.F) { \
+        throw std::runtime_error("Failed to load " #F " from " + PATH); \
+    }
+
+#define LOAD_GET_SET(NAME, INDEX) \
+    LOAD_FUNCTION(fmi3Get##NAME, api, path) \
+    LOAD_FUNCTION(fmi3Set##NAME, api, path)
+
+// The libraries are never unloaded: the Liaison FMU closes its Zenoh session
+// on a background thread, a few seconds after its last instance was freed.
+FmuApi loadFmuApi(const std::string& path) {
+    FmuApi api;
+    api.library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!api.library) {
+        throw std::runtime_error("Failed to load " + path + ": " + dlerror());
+    }
+    LOAD_FUNCTION(fmi3InstantiateCoSimulation, api, path)
+    LOAD_FUNCTION(fmi3FreeInstance, api, path)
+    LOAD_FUNCTION(fmi3EnterInitializationMode, api, path)
+    LOAD_FUNCTION(fmi3ExitInitializationMode, api, path)
+    LOAD_FUNCTION(fmi3Terminate, api, path)
+    LOAD_FUNCTION(fmi3DoStep, api, path)
+    api.liaisonDoStepBatch = reinterpret_cast<liaisonDoStepBatchTYPE*>(dlsym(api.library, "liaisonDoStepBatch"));
+    FOR_EACH_NUMERIC_TYPE(LOAD_GET_SET)
+    LOAD_GET_SET(String, TYPE_INDEX_STRING)
+    LOAD_GET_SET(Binary, TYPE_INDEX_BINARY)
+    return api;
+}
+
+
+void logMessage(fmi3InstanceEnvironment instanceEnvironment, fmi3Status status, fmi3String category, fmi3String message) {
+    std::cerr << "[" << (category ? category : "") << "] " << (message ? message : "") << std::endl;
+}
+
+void check(fmi3Status status, const std::string& what) {
+    if (status > fmi3Warning) {
+        throw std::runtime_error(what + " failed with status " + std::to_string(status));
+    }
+}
+
+std::string instantiationToken(const std::string& model) {
+    return "{liaison-bench-" + model + "}";
+}
+
+// An FMU under test: the original library, or the Liaison FMU of the same model.
+struct Target {
+    std::string model;
+    FmuApi api;
+    std::string resourcePath;
+    bool remote = false;
+
+    fmi3Instance Instantiate() const {
+        return api.fmi3InstantiateCoSimulation(model.c_str(), instantiationToken(model).c_str(), resourcePath.c_str(),
+            fmi3False, fmi3False, fmi3False, fmi3False, nullptr, 0, nullptr, logMessage, nullptr);
+    }
+
+    // The server may still be starting, so the first instance is retried.
+    fmi3Instance InstantiateWhenReady() const {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(remote ? 30 : 0);
+        while (true) {
+            fmi3Instance instance = Instantiate();
+            if (instance) {
+                return instance;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                throw std::runtime_error("Failed to instantiate " + model);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+    }
+
+    fmi3Status DoStep(fmi3Instance instance, fmi3Float64& time, fmi3Float64 stepSize) const {
+        fmi3Boolean eventHandlingNeeded = fmi3False, terminateSimulation = fmi3False, earlyReturn = fmi3False;
+        fmi3Float64 lastSuccessfulTime = 0.0;
+        fmi3Status status = api.fmi3DoStep(instance, time, stepSize, fmi3True,
+            &eventHandlingNeeded, &terminateSimulation, &earlyReturn, &lastSuccessfulTime);
+        time += stepSize;
+        return status;
+    }
+
+    // Steps instances in lockstep: in a single call with the batch extension
+    // of the Liaison FMU, otherwise one after the other.
+    fmi3Status DoStepAll(const std::vector<fmi3Instance>& instances, fmi3Float64& time, fmi3Float64 stepSize) const {
+        size_t n = instances.size();
+        if (!api.liaisonDoStepBatch) {
+            fmi3Status status = fmi3OK;
+            for (fmi3Instance instance : instances) {
+                fmi3Float64 instanceTime = time;
+                status = std::max(status, DoStep(instance, instanceTime, stepSize));
+            }
+            time += stepSize;
+            return status;
+        }
+        std::vector<fmi3Float64> times(n, time), lastSuccessfulTimes(n);
+        // fmi3Boolean is bool, which std::vector packs
+        std::unique_ptr<fmi3Boolean[]> eventHandlingNeeded(new fmi3Boolean[n]()), terminateSimulation(new fmi3Boolean[n]()), earlyReturn(new fmi3Boolean[n]());
+        std::vector<fmi3Status> statuses(n);
+        fmi3Status status = api.liaisonDoStepBatch(const_cast<fmi3Instance*>(instances.data()), n, times.data(), stepSize, fmi3True,
+            eventHandlingNeeded.get(), terminateSimulation.get(), earlyReturn.get(), lastSuccessfulTimes.data(), statuses.data());
+        time += stepSize;
+        return status;
+    }
+};
+
+
+// Latency and throughput of repeated calls. A call may be several FMI calls.
+template <typename Call>
+json measure(const Options& options, const std::string& what, Call call) {
+    for (size_t i = 0; i < options.warmup; ++i) {
+        check(call(), what);
+    }
+    std::unique_ptr<stats::Histogram> latency(new stats::Histogram());
+    uint64_t start = stats::now();
+    for (size_t i = 0; i < options.iterations; ++i) {
+        uint64_t before = stats::now();
+        fmi3Status status = call();
+        latency->record(stats::now() - before);
+        check(status, what);
+    }
+    double elapsed = (stats::now() - start) * 1e-9;
+    return {
+        {"calls", options.iterations},
+        {"callsPerSecond", elapsed > 0 ? options.iterations / elapsed : 0.0},
+        {"latency", latency->toJson()}
+    };
+}
+
+struct Result {
+    std::string function;
+    json parameters;
+    json measurement;
+};
+
+typedef void (*Benchmark)(const Options&, const Target&, std::vector<Result>&);
+
+std::vector<fmi3ValueReference> valueReferences(size_t typeIndex, size_t size) {
+    std::vector<fmi3ValueReference> result(size);
+    for (size_t i = 0; i < size; ++i) {
+        result[i] = static_cast<fmi3ValueReference>((typeIndex + 1) * VR_BLOCK + i);
+    }
+    return result;
+}
+
+std::vector<size_t> variableCounts() {
+    std::vector<size_t> counts;
+    for (size_t count : {size_t(1), size_t(16), size_t(LIAISON_BENCH_VARIABLES)}) {
+        if (count <= LIAISON_BENCH_VARIABLES && std::find(counts.begin(), counts.end(), count) == counts.end()) {
+            counts.push_back(count);
+        }
+    }
+    return counts;
+}
+
+
+void benchmarkNoop(const Options& options, const Target& target, std::vector<Result>& results) {
+    target.api.fmi3FreeInstance(target.InstantiateWhenReady());
+    results.push_back({"fmi3InstantiateCoSimulation+fmi3FreeInstance", json::object(),
+        measure(options, "fmi3InstantiateCoSimulation", [&]() {
+            fmi3Instance instance = target.Instantiate();
+            if (!instance) {
+                return fmi3Error;
+            }
+            target.api.fmi3FreeInstance(instance);
+            return fmi3OK;
+        })});
+
+    fmi3Instance instance = target.InstantiateWhenReady();
+    fmi3Float64 time = 0;
+    check(target.api.fmi3EnterInitializationMode(instance, fmi3False, 0, time, fmi3False, 0), "fmi3EnterInitializationMode");
+    check(target.api.fmi3ExitInitializationMode(instance), "fmi3ExitInitializationMode");
+    results.push_back({"fmi3DoStep", json::object(),
+        measure(options, "fmi3DoStep", [&]() { return target.DoStep(instance, time, 0.01); })});
+    check(target.api.fmi3Terminate(instance), "fmi3Terminate");
+    target.api.fmi3FreeInstance(instance);
+
+    // Lockstep ensemble, batched by the Liaison FMU
+    std::vector<fmi3Instance> ensemble;
+    for (size_t i = 0; i < ENSEMBLE_SIZE; ++i) {
+        ensemble.push_back(target.InstantiateWhenReady());
+    }
+    time = 0;
+    for (fmi3Instance member : ensemble) {
+        check(target.api.fmi3EnterInitializationMode(member, fmi3False, 0, time, fmi3False, 0), "fmi3EnterInitializationMode");
+        check(target.api.fmi3ExitInitializationMode(member), "fmi3ExitInitializationMode");
+    }
+    results.push_back({"fmi3DoStep (ensemble)", {{"instances", ENSEMBLE_SIZE}},
+        measure(options, "fmi3DoStep", [&]() { return target.DoStepAll(ensemble, time, 0.01); })});
+    for (fmi3Instance member : ensemble) {
+        check(target.api.fmi3Terminate(member), "fmi3Terminate");
+        target.api.fmi3FreeInstance(member);
+    }
+}
+
+// Get and Set calls run in Initialization Mode, where every call reaches the
+// server. The Set/DoStep/Get cycle runs in Step Mode.
+void benchmarkVariables(const Options& options, const Target& target, std::vector<Result>& results) {
+    fmi3Instance instance = target.InstantiateWhenReady();
+    fmi3Float64 time = 0;
+    check(target.api.fmi3EnterInitializationMode(instance, fmi3False, 0, time, fmi3False, 0), "fmi3EnterInitializationMode");
+
+#define BENCHMARK_GET_SET(TYPE, INDEX) \
+    for (size_t size : variableCounts()) { \
+        std::vector<fmi3ValueReference> vrs = valueReferences(INDEX, size); \
+        std::unique_ptr<fmi3##TYPE[]> values(new fmi3##TYPE[size]()); \
+        json parameters = {{"type", #TYPE}, {"size", size}}; \
+        results.push_back({"fmi3Set" #TYPE, parameters, measure(options, "fmi3Set" #TYPE, [&]() { \
+            return target.api.fmi3Set##TYPE(instance, vrs.data(), size, values.get(), size); \
+        })}); \
+        results.push_back({"fmi3Get" #TYPE, parameters, measure(options, "fmi3Get" #TYPE, [&]() { \
+            return target.api.fmi3Get##TYPE(instance, vrs.data(), size, values.get(), size); \
+        })}); \
+    }
+    FOR_EACH_NUMERIC_TYPE(BENCHMARK_GET_SET)
+#undef BENCHMARK_GET_SET
+
+    for (size_t size : variableCounts()) {
+        std::vector<fmi3ValueReference> vrs = valueReferences(TYPE_INDEX_STRING, size);
+        std::vector<fmi3String> values(size, "0123456789abcdef");
+        json parameters = {{"type", "String"}, {"size", size}};
+        results.push_back({"fmi3SetString", parameters, measure(options, "fmi3SetString", [&]() {
+            return target.api.fmi3SetString(instance, vrs.data(), size, values.data(), size);
+        })});
+        results.push_back({"fmi3GetString", parameters, measure(options, "fmi3GetString", [&]() {
+            return target.api.fmi3GetString(instance, vrs.data(), size, values.data(), size);
+        })});
+    }
+
+    if (options.binary) {
+        for (size_t size : variableCounts()) {
+            std::vector<fmi3ValueReference> vrs = valueReferences(TYPE_INDEX_BINARY, size);
+            std::vector<fmi3Byte> bytes(16, 0x5a);
+            std::vector<fmi3Binary> values(size, bytes.data());
+            std::vector<size_t> sizes(size, bytes.size());
+            json parameters = {{"type", "Binary"}, {"size", size}};
+            results.push_back({"fmi3SetBinary", parameters, measure(options, "fmi3SetBinary", [&]() {
+                return target.api.fmi3SetBinary(instance, vrs.data(), size, sizes.data(), values.data(), size);
+            })});
+            results.push_back({"fmi3GetBinary", parameters, measure(options, "fmi3GetBinary", [&]() {
+                return target.api.fmi3GetBinary(instance, vrs.data(), size, sizes.data(), values.data(), size);
+            })});
+        }
+    }
+
+    check(target.api.fmi3ExitInitializationMode(instance), "fmi3ExitInitializationMode");
+
+    size_t size = std::min<size_t>(16, LIAISON_BENCH_VARIABLES);
+    std::vector<fmi3ValueReference> vrs = valueReferences(1, size);
+    std::vector<fmi3Float64> values(size);
+    results.push_back({"fmi3SetFloat64+fmi3DoStep+fmi3GetFloat64", {{"type", "Float64"}, {"size", size}},
+        measure(options, "Step cycle", [&]() {
+            for (fmi3Float64& value : values) {
+                value += 1;
+            }
+            fmi3Status status = target.api.fmi3SetFloat64(instance, vrs.data(), size, values.data(), size);
+            status = std::max(status, target.DoStep(instance, time, 0.01));
+            return std::max(status, target.api.fmi3GetFloat64(instance, vrs.data(), size, values.data(), size));
+        })});
+
+    check(target.api.fmi3Terminate(instance), "fmi3Terminate");
+    target.api.fmi3FreeInstance(instance);
+}
+
+// String and Binary outputs of increasing size, then steps of increasing cost.
+void benchmarkBusy(const Options& options, const Target& target, std::vector<Result>& results) {
+    fmi3Instance instance = target.InstantiateWhenReady();
+    fmi3Float64 time = 0;
+    check(target.api.fmi3EnterInitializationMode(instance, fmi3False, 0, time, fmi3False, 0), "fmi3EnterInitializationMode");
+
+    const fmi3ValueReference sizeVrs[] = {VR_STRING_SIZE, VR_BINARY_SIZE};
+    for (fmi3UInt64 bytes : {fmi3UInt64(16), fmi3UInt64(1024), fmi3UInt64(65536), fmi3UInt64(4194304)}) {
+        const fmi3UInt64 sizes[] = {bytes, bytes};
+        check(target.api.fmi3SetUInt64(instance, sizeVrs, 2, sizes, 2), "fmi3SetUInt64");
+        json parameters = {{"bytes", bytes}};
+
+        const fmi3ValueReference stringVr = VR_STRING;
+        fmi3String string = nullptr;
+        parameters["type"] = "String";
+        results.push_back({"fmi3GetString", parameters, measure(options, "fmi3GetString", [&]() {
+            return target.api.fmi3GetString(instance, &stringVr, 1, &string, 1);
+        })});
+
+        if (options.binary) {
+            const fmi3ValueReference binaryVr = VR_BINARY;
+            fmi3Binary binary = nullptr;
+            size_t binarySize = 0;
+            parameters["type"] = "Binary";
+            results.push_back({"fmi3GetBinary", parameters, measure(options, "fmi3GetBinary", [&]() {
+                return target.api.fmi3GetBinary(instance, &binaryVr, 1, &binarySize, &binary, 1);
+            })});
+        }
+    }
+
+    check(target.api.fmi3ExitInitializationMode(instance), "fmi3ExitInitializationMode");
+
+    const fmi3ValueReference busyTimeVr = VR_BUSY_TIME;
+    for (fmi3Float64 busyTime : {0.0, 1e-4, 1e-3}) {
+        check(target.api.fmi3SetFloat64(instance, &busyTimeVr, 1, &busyTime, 1), "fmi3SetFloat64");
+        results.push_back({"fmi3DoStep", {{"busyTime", busyTime}},
+            measure(options, "fmi3DoStep", [&]() { return target.DoStep(instance, time, 0.01); })});
+    }
+
+    check(target.api.fmi3Terminate(instance), "fmi3Terminate");
+    target.api.fmi3FreeInstance(instance);
+}
+
+
+void writeJson(const std::filesystem::path& path, const json& content) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Failed to write " + path.string());
+    }
+    file << content.dump(4) << std::endl;
+}
+
+json zenohConfig(const Options& options, bool server) {
+    std::string endpoint = "tcp/127.0.0.1:" + std::to_string(options.port);
+    json config = {
+        {"mode", server ? "peer" : "client"},
+        {"scouting", {{"multicast", {{"enabled", false}}}}}
+    };
+    config[server ? "listen" : "connect"] = {{"endpoints", {endpoint}}};
+    return config;
+}
+
+std::string responderId(const std::string& model) {
+    return "liaison-bench-" + model;
+}
+
+// A 'liaison --serve' process for all models, stopped by writing 'q' to its stdin.
+class Server {
+public:
+    Server(const Options& options, const std::filesystem::path& workDirectory, const std::vector<std::string>& models) {
+        json manifest = {{"fmus", json::array()}};
+        for (const auto& model : models) {
+            manifest["fmus"].push_back({
+                {"path", (std::filesystem::path(options.fmuDirectory) / (model + ".fmu")).string()},
+                {"responderId", responderId(model)}
+            });
+        }
+        writeJson(workDirectory / "manifest.json", manifest);
+        writeJson(workDirectory / "server.json", zenohConfig(options, true));
+
+        std::ostringstream command;
+        command << "'" << options.server << "' --serve '" << (workDirectory / "manifest.json").string() << "'"
+                << " --zenoh-config '" << (workDirectory / "server.json").string() << "'";
+        if (options.workers > 0) {
+            command << " --workers " << options.workers;
+        }
+#ifdef LIAISON_BENCH_COUNT_ALLOCATIONS
+        command << " --stats-file '" << (workDirectory / "stats.json").string() << "' --stats-interval 1";
+#endif
+        command << " > '" << (workDirectory / "server.log").string() << "' 2>&1";
+        process = popen(command.str().c_str(), "w");
+        if (!process) {
+            throw std::runtime_error("Failed to start " + options.server);
+        }
+    }
+
+    ~Server() {
+        fputs("q\n", process);
+        fflush(process);
+        pclose(process);
+    }
+
+private:
+    FILE* process = nullptr;
+};
+
+#ifdef LIAISON_BENCH_COUNT_ALLOCATIONS
+// Statistics of the server from a write that started after this call. The
+// server writes them every second, so the second write to complete is the
+// first one that is certain to include every call made before.
+json readServerStats(const std::filesystem::path& statsFile) {
+    std::filesystem::file_time_type written = std::filesystem::file_time_type::clock::now();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    for (int writes = 0; writes < 2;) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            throw std::runtime_error("No statistics written to " + statsFile.string());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::error_code error;
+        std::filesystem::file_time_type time = std::filesystem::last_write_time(statsFile, error);
+        if (!error && time > written) {
+            written = time;
+            ++writes;
+        }
+    }
+    std::ifstream file(statsFile);
+    return json::parse(file);
+}
+
+// Heap allocations in any phase of Get, Set and DoStep calls between two
+// statistics snapshots, as "<function> <phase>: <count>" lines. No phase is
+// exempt: the checked calls carry a few values, so their replies stay below
+// COPY_THRESHOLD, above which a reply gets a new buffer unless it is written
+// to shared memory. The copy that Zenoh makes of small replies is not counted
+// (see payload::serialize).
+std::vector<std::string> steadyStateAllocations(const json& before, const json& after) {
+    std::vector<std::string> failures;
+    for (const auto& model : after.items()) {
+        for (const auto& function : model.value()["functions"].items()) {
+            const std::string& name = function.key();
+            if (name.rfind("fmi3Get", 0) != 0 && name.rfind("fmi3Set", 0) != 0 && name != "fmi3DoStep"
+                && name != "fmi3Exchange" && name != "fmi3BatchExchange") {
+                continue;
+            }
+            for (const auto& phase : function.value()["allocations"].items()) {
+                json::json_pointer pointer("/" + model.key() + "/functions/" + name + "/allocations/" + phase.key());
+                uint64_t count = phase.value().get<uint64_t>();
+                if (before.contains(pointer)) {
+                    count -= before[pointer].get<uint64_t>();
+                }
+                if (count > 0) {
+                    failures.push_back(name + " " + phase.key() + ": " + std::to_string(count));
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+// Runs Get/Set calls in Initialization Mode and the Set/DoStep/Get cycle in
+// Step Mode, each after a warmup, and returns the allocations the server made
+// for them.
+std::vector<std::string> checkAllocations(const Options& options, const Target& target, const std::filesystem::path& statsFile) {
+    std::vector<std::string> failures;
+    auto measureAllocations = [&](auto call, const std::string& what) {
+        for (size_t i = 0; i < options.warmup; ++i) {
+            check(call(), what);
+        }
+        json before = readServerStats(statsFile);
+        for (size_t i = 0; i < options.iterations; ++i) {
+            check(call(), what);
+        }
+        for (std::string& failure : steadyStateAllocations(before, readServerStats(statsFile))) {
+            failures.push_back(what + ": " + failure);
+        }
+    };
+
+    fmi3Instance instance = target.InstantiateWhenReady();
+    fmi3Float64 time = 0;
+    check(target.api.fmi3EnterInitializationMode(instance, fmi3False, 0, time, fmi3False, 0), "fmi3EnterInitializationMode");
+
+    size_t size = std::min<size_t>(16, LIAISON_BENCH_VARIABLES);
+    std::vector<fmi3ValueReference> vrs = valueReferences(1, size);
+    std::vector<fmi3Float64> values(size);
+    measureAllocations([&]() {
+        fmi3Status status = target.api.fmi3SetFloat64(instance, vrs.data(), size, values.data(), size);
+        return std::max(status, target.api.fmi3GetFloat64(instance, vrs.data(), size, values.data(), size));
+    }, "Initialization Mode");
+
+    check(target.api.fmi3ExitInitializationMode(instance), "fmi3ExitInitializationMode");
+    measureAllocations([&]() {
+        for (fmi3Float64& value : values) {
+            value += 1;
+        }
+        fmi3Status status = target.api.fmi3SetFloat64(instance, vrs.data(), size, values.data(), size);
+        status = std::max(status, target.DoStep(instance, time, 0.01));
+        return std::max(status, target.api.fmi3GetFloat64(instance, vrs.data(), size, values.data(), size));
+    }, "Step cycle");
+
+    check(target.api.fmi3Terminate(instance), "fmi3Terminate");
+    target.api.fmi3FreeInstance(instance);
+    return failures;
+}
+#endif
+
+// Copy of the Liaison FMU library with its config.json. Every model gets its
+// own copy, since the configuration is read once per loaded library.
+std::string makeLiaisonFmu(const Options& options, const std::filesystem::path& workDirectory, const std::string& model) {
+    std::filesystem::path binaries = workDirectory / model / "binaries";
+    std::filesystem::create_directories(binaries / "x86_64-linux");
+    std::filesystem::path library = binaries / "x86_64-linux" / (model + ".so");
+    std::filesystem::copy_file(options.client, library, std::filesystem::copy_options::overwrite_existing);
+    writeJson(binaries / "config.json", {
+        {"responderId", responderId(model)},
+        {"encoding", options.encoding},
+        {"localRealTime", options.localRealTime},
+        {"zenohConfig", zenohConfig(options, false)}
+    });
+    return library.string();
+}
+
+
+void printUsage() {
+    std::cout << "Usage:\n"
+              << "  liaison_bench [options]\n\n"
+              << "Options:\n"
+              << "  --iterations <N>     Measured calls per case (default 1000)\n"
+              << "  --warmup <N>         Calls before measuring (default 100)\n"
+              << "  --workers <N>        Worker threads of the server\n"
+              << "  --port <N>           Loopback port of the server (default 7448)\n"
+              << "  --encoding <name>    'compact' or 'protobuf' (default compact)\n"
+              << "  --no-binary          Skip the Binary cases\n"
+              << "  --local-rt           Use the local real-time mode\n"
+              << "  --output <path>      JSON report (default liaison_bench.json)\n"
+              << "  --server <path>      Liaison executable\n"
+              << "  --client <path>      Liaison FMU library\n"
+              << "  --fmu-dir <path>     Directory of the synthetic FMUs\n";
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        if (option == "--help") {
+            printUsage();
+            exit(0);
+        } else if (option == "--no-binary") {
+            options.binary = false;
+            continue;
+        } else if (option == "--local-rt") {
+            options.localRealTime = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printUsage();
+            throw std::runtime_error("Missing value for " + option);
+        }
+        std::string value = argv[++i];
+        if (option == "--iterations") {
+            options.iterations = std::stoul(value);
+        } else if (option == "--warmup") {
+            options.warmup = std::stoul(value);
+        } else if (option == "--workers") {
+            options.workers = std::stoul(value);
+        } else if (option == "--port") {
+            options.port = std::stoi(value);
+        } else if (option == "--encoding") {
+            options.encoding = value;
+        } else if (option == "--output") {
+            options.output = value;
+        } else if (option == "--server") {
+            options.server = value;
+        } else if (option == "--client") {
+            options.client = value;
+        } else if (option == "--fmu-dir") {
+            options.fmuDirectory = value;
+        } else {
+            printUsage();
+            throw std::runtime_error("Unknown option " + option);
+        }
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    std::filesystem::path workDirectory =
+        std::filesystem::temp_directory_path() / ("liaison_bench_" + std::to_string(getpid()));
+    try {
+        Options options = parseOptions(argc, argv);
+        std::filesystem::create_directories(workDirectory);
+
+        const std::vector<std::pair<std::string, Benchmark>> benchmarks = {
+            {"Noop", benchmarkNoop},
+            {"Variables", benchmarkVariables},
+            {"Busy", benchmarkBusy}
+        };
+        std::vector<std::string> models;
+        for (const auto& benchmark : benchmarks) {
+            models.push_back(benchmark.first);
+        }
+
+        json report = {
+            {"config", {
+                {"iterations", options.iterations},
+                {"warmup", options.warmup},
+                {"workers", options.workers},
+                {"encoding", options.encoding},
+                {"variables", LIAISON_BENCH_VARIABLES},
+                {"binary", options.binary},
+                {"localRealTime", options.localRealTime}
+            }},
+            {"results", json::array()}
+        };
+
+        std::vector<std::string> allocationFailures;
+        {
+            Server server(options, workDirectory, models);
+            for (const auto& benchmark : benchmarks) {
+                const std::string& model = benchmark.first;
+                std::filesystem::path stage = std::filesystem::path(options.fmuDirectory) / model;
+
+                Target inProcess;
+                inProcess.model = model;
+                inProcess.api = loadFmuApi((stage / "binaries" / "x86_64-linux" / (model + ".so")).string());
+                inProcess.resourcePath = (stage / "resources").string();
+
+                Target liaison;
+                liaison.model = model;
+                liaison.api = loadFmuApi(makeLiaisonFmu(options, workDirectory, model));
+                liaison.resourcePath = inProcess.resourcePath;
+                liaison.remote = true;
+
+                std::cerr << "Benchmarking " << model << "..." << std::endl;
+                std::vector<Result> local, remote;
+                benchmark.second(options, inProcess, local);
+                benchmark.second(options, liaison, remote);
+
+                for (size_t i = 0; i < local.size() && i < remote.size(); ++i) {
+                    json result = {{"model", model}, {"function", local[i].function}};
+                    result.update(local[i].parameters);
+                    result["inProcess"] = local[i].measurement;
+                    result["liaison"] = remote[i].measurement;
+                    int64_t localP50 = local[i].measurement["latency"]["p50Ns"];
+                    int64_t remoteP50 = remote[i].measurement["latency"]["p50Ns"];
+                    result["overheadP50Ns"] = remoteP50 - localP50;
+                    std::cerr << "  " << local[i].function << " " << local[i].parameters.dump()
+                              << ": p50 " << localP50 << " ns in-process, " << remoteP50 << " ns with Liaison" << std::endl;
+                    report["results"].push_back(std::move(result));
+                }
+#ifdef LIAISON_BENCH_COUNT_ALLOCATIONS
+                if (model == "Variables") {
+                    std::cerr << "Checking server allocations..." << std::endl;
+                    allocationFailures = checkAllocations(options, liaison, workDirectory / "stats.json");
+                }
+#endif
+            }
+        }
+
+        writeJson(options.output, report);
+        std::cerr << "Results written to " << options.output << std::endl;
+        if (!allocationFailures.empty()) {
+            for (const auto& failure : allocationFailures) {
+                std::cerr << "  Allocations after warmup in " << failure << std::endl;
+            }
+            throw std::runtime_error("The server allocated in steady-state Get, Set or DoStep calls");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << "The server log is kept in " << workDirectory.string() << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(workDirectory);
+    return 0;
+}
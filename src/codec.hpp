@@ -0,0 +1,306 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "fmi3PlatformTypes.h"
+
+
+// Compact fixed-layout encoding of the numeric fmi3Get*/fmi3Set* payloads,
+// used instead of protobuf when negotiated at instantiation.
+//
+//   Set request: [header][uint32 value references][values]
+//   Get request: [header][uint32 value references]
+//   Set reply:   [header]
+//   Get reply:   [header][values]
+//
+// All fields are little-endian. Values are contiguous arrays of the FMI type,
+// except Booleans, which are bit-packed (least significant bit first).
+//
+// With FLAG_HANDLE, a request refers to value references registered with
+// fmi3RegisterValueReferences: they are not sent, and the header holds the
+// handle in place of n_value_references.
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CODEC_BIG_ENDIAN
+#endif
+
+namespace codec {
+
+const uint8_t VERSION = 1;
+const size_t HEADER_SIZE = 16;
+const size_t STATUS_OFFSET = 2;
+const uint8_t FLAG_HANDLE = 1;
+
+enum class Type : uint8_t {
+    Float32,
+    Float64,
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Int64,
+    UInt64,
+    Boolean
+};
+
+const size_t N_TYPES = static_cast<size_t>(Type::Boolean) + 1;
+
+// Type of a variable element of the model description, e.g. "Float64".
+inline bool parseType(const std::string& name, Type& type) {
+    static const char* const names[N_TYPES] = {"Float32", "Float64", "Int8", "UInt8", "Int16", "UInt16", "Int32", "UInt32", "Int64", "UInt64", "Boolean"};
+    for (size_t i = 0; i < N_TYPES; ++i) {
+        if (name == names[i]) {
+            type = static_cast<Type>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct Header {
+    uint8_t version = VERSION;
+    Type type = Type::Float64;
+    uint8_t status = 0;
+    uint8_t flags = 0;
+    int32_t instance_index = 0;
+    uint32_t n_value_references = 0; // handle with FLAG_HANDLE
+    uint32_t n_values = 0;
+};
+
+template <typename T>
+inline void copyToLittleEndian(uint8_t* out, const T* in, size_t n) {
+#ifdef CODEC_BIG_ENDIAN
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(in);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t b = 0; b < sizeof(T); ++b) {
+            out[i * sizeof(T) + b] = bytes[i * sizeof(T) + sizeof(T) - 1 - b];
+        }
+    }
+#else
+    std::memcpy(out, in, n * sizeof(T));
+#endif
+}
+
+template <typename T>
+inline void copyFromLittleEndian(T* out, const uint8_t* in, size_t n) {
+#ifdef CODEC_BIG_ENDIAN
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(out);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t b = 0; b < sizeof(T); ++b) {
+            bytes[i * sizeof(T) + b] = in[i * sizeof(T) + sizeof(T) - 1 - b];
+        }
+    }
+#else
+    std::memcpy(out, in, n * sizeof(T));
+#endif
+}
+
+inline size_t valueReferencesSize(size_t n) {
+    return n * sizeof(fmi3ValueReference);
+}
+
+template <typename T>
+inline size_t valuesSize(size_t n) {
+    return n * sizeof(T);
+}
+
+template <>
+inline size_t valuesSize<fmi3Boolean>(size_t n) {
+    return (n + 7) / 8;
+}
+
+template <typename T>
+inline void writeValues(uint8_t* out, const T* values, size_t n) {
+    copyToLittleEndian(out, values, n);
+}
+
+template <>
+inline void writeValues<fmi3Boolean>(uint8_t* out, const fmi3Boolean* values, size_t n) {
+    std::memset(out, 0, valuesSize<fmi3Boolean>(n));
+    for (size_t i = 0; i < n; ++i) {
+        if (values[i]) {
+            out[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+        }
+    }
+}
+
+template <typename T>
+inline void readValues(T* values, const uint8_t* in, size_t n) {
+    copyFromLittleEndian(values, in, n);
+}
+
+template <>
+inline void readValues<fmi3Boolean>(fmi3Boolean* values, const uint8_t* in, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = (in[i / 8] >> (i % 8)) & 1u;
+    }
+}
+
+// Values of type T stored in the wire layout at data, or nullptr if they must
+// be converted: Booleans, big-endian hosts and unaligned data.
+template <typename T>
+inline const T* inPlaceValues(const uint8_t* data) {
+#ifdef CODEC_BIG_ENDIAN
+    return nullptr;
+#else
+    return reinterpret_cast<uintptr_t>(data) % alignof(T) == 0 ? reinterpret_cast<const T*>(data) : nullptr;
+#endif
+}
+
+template <>
+inline const fmi3Boolean* inPlaceValues<fmi3Boolean>(const uint8_t*) {
+    return nullptr;
+}
+
+inline void writeHeader(uint8_t* out, const Header& header) {
+    out[0] = header.version;
+    out[1] = static_cast<uint8_t>(header.type);
+    out[STATUS_OFFSET] = header.status;
+    out[3] = header.flags;
+    copyToLittleEndian(out + 4, &header.instance_index, 1);
+    copyToLittleEndian(out + 8, &header.n_value_references, 1);
+    copyToLittleEndian(out + 12, &header.n_values, 1);
+}
+
+// Returns false if the buffer is too short or was encoded with another version.
+inline bool readHeader(const uint8_t* in, size_t size, Header& header) {
+    if (size < HEADER_SIZE || in[0] != VERSION) {
+        return false;
+    }
+    header.version = in[0];
+    header.type = static_cast<Type>(in[1]);
+    header.status = in[STATUS_OFFSET];
+    header.flags = in[3];
+    copyFromLittleEndian(&header.instance_index, in + 4, 1);
+    copyFromLittleEndian(&header.n_value_references, in + 8, 1);
+    copyFromLittleEndian(&header.n_values, in + 12, 1);
+    return true;
+}
+
+template <typename Buffer>
+inline uint8_t* bufferData(Buffer& buffer) {
+    return reinterpret_cast<uint8_t*>(&buffer[0]);
+}
+
+template <typename Buffer>
+inline const uint8_t* bufferData(const Buffer& buffer) {
+    return reinterpret_cast<const uint8_t*>(buffer.data());
+}
+
+template <typename T, typename Buffer>
+void encodeSetRequest(Buffer& out, Type type, int32_t instanceIndex,
+                      const fmi3ValueReference valueReferences[], size_t nValueReferences,
+                      const T values[], size_t nValues) {
+    Header header;
+    header.type = type;
+    header.instance_index = instanceIndex;
+    header.n_value_references = static_cast<uint32_t>(nValueReferences);
+    header.n_values = static_cast<uint32_t>(nValues);
+    out.resize(HEADER_SIZE + valueReferencesSize(nValueReferences) + valuesSize<T>(nValues));
+    uint8_t* data = bufferData(out);
+    writeHeader(data, header);
+    copyToLittleEndian(data + HEADER_SIZE, valueReferences, nValueReferences);
+    writeValues(data + HEADER_SIZE + valueReferencesSize(nValueReferences), values, nValues);
+}
+
+template <typename Buffer>
+void encodeGetRequest(Buffer& out, Type type, int32_t instanceIndex,
+                      const fmi3ValueReference valueReferences[], size_t nValueReferences,
+                      size_t nValues) {
+    Header header;
+    header.type = type;
+    header.instance_index = instanceIndex;
+    header.n_value_references = static_cast<uint32_t>(nValueReferences);
+    header.n_values = static_cast<uint32_t>(nValues);
+    out.resize(HEADER_SIZE + valueReferencesSize(nValueReferences));
+    uint8_t* data = bufferData(out);
+    writeHeader(data, header);
+    copyToLittleEndian(data + HEADER_SIZE, valueReferences, nValueReferences);
+}
+
+template <typename T, typename Buffer>
+void encodeSetRequest(Buffer& out, Type type, int32_t instanceIndex, uint32_t handle,
+                      const T values[], size_t nValues) {
+    Header header;
+    header.type = type;
+    header.flags = FLAG_HANDLE;
+    header.instance_index = instanceIndex;
+    header.n_value_references = handle;
+    header.n_values = static_cast<uint32_t>(nValues);
+    out.resize(HEADER_SIZE + valuesSize<T>(nValues));
+    uint8_t* data = bufferData(out);
+    writeHeader(data, header);
+    writeValues(data + HEADER_SIZE, values, nValues);
+}
+
+template <typename Buffer>
+void encodeGetRequest(Buffer& out, Type type, int32_t instanceIndex, uint32_t handle, size_t nValues) {
+    Header header;
+    header.type = type;
+    header.flags = FLAG_HANDLE;
+    header.instance_index = instanceIndex;
+    header.n_value_references = handle;
+    header.n_values = static_cast<uint32_t>(nValues);
+    out.resize(HEADER_SIZE);
+    writeHeader(bufferData(out), header);
+}
+
+template <typename Buffer>
+void encodeStatusReply(Buffer& out, Type type, uint8_t status) {
+    Header header;
+    header.type = type;
+    header.status = status;
+    out.resize(HEADER_SIZE);
+    writeHeader(bufferData(out), header);
+}
+
+template <typename T, typename Buffer>
+void encodeGetReply(Buffer& out, Type type, uint8_t status, const T values[], size_t nValues) {
+    Header header;
+    header.type = type;
+    header.status = status;
+    header.n_values = static_cast<uint32_t>(nValues);
+    out.resize(HEADER_SIZE + valuesSize<T>(nValues));
+    uint8_t* data = bufferData(out);
+    writeHeader(data, header);
+    writeValues(data + HEADER_SIZE, values, nValues);
+}
+
+// Sizes a Get reply for nValues values and returns where the caller can write
+// them in place, or nullptr if it must use encodeGetReply instead. The header
+// is written by finishGetReply.
+template <typename T, typename Buffer>
+T* prepareGetReply(Buffer& out, size_t nValues) {
+    out.resize(HEADER_SIZE + valuesSize<T>(nValues));
+    uint8_t* data = bufferData(out) + HEADER_SIZE;
+    return inPlaceValues<T>(data) ? reinterpret_cast<T*>(data) : nullptr;
+}
+
+template <typename Buffer>
+void finishGetReply(Buffer& out, Type type, uint8_t status, size_t nValues) {
+    Header header;
+    header.type = type;
+    header.status = status;
+    header.n_values = static_cast<uint32_t>(nValues);
+    writeHeader(bufferData(out), header);
+}
+
+// Returns false if the reply does not hold nValues values of type T.
+template <typename T>
+bool decodeGetReply(const uint8_t* in, size_t size, const Header& header, T values[], size_t nValues) {
+    if (header.n_values != nValues || size < HEADER_SIZE + valuesSize<T>(nValues)) {
+        return false;
+    }
+    readValues(values, in + HEADER_SIZE, nValues);
+    return true;
+}
+
+} // namespace codec
+
+#endif // CODEC_HPP
@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <exception>
+#include <spdlog/spdlog.h>
+#include "executor.hpp"
+
+
+// Maximum number of tasks a strand runs before yielding its worker.
+#define STRAND_BATCH_SIZE 16
+
+namespace {
+    thread_local Executor* currentExecutor = nullptr;
+    thread_local size_t currentWorker = 0;
+}
+
+
+void TaskQueue::push_back(Task task) {
+    if (count == tasks.size()) {
+        std::vector<Task> grown(std::max<size_t>(16, 2 * tasks.size()));
+        for (size_t i = 0; i < count; ++i) {
+            grown[i] = std::move(tasks[(head + i) % tasks.size()]);
+        }
+        tasks.swap(grown);
+        head = 0;
+    }
+    tasks[(head + count) % tasks.size()] = std::move(task);
+    count++;
+}
+
+Task TaskQueue::pop_front() {
+    Task task = std::move(tasks[head]);
+    tasks[head] = nullptr;
+    head = (head + 1) % tasks.size();
+    count--;
+    return task;
+}
+
+Task TaskQueue::pop_back() {
+    size_t index = (head + count - 1) % tasks.size();
+    Task task = std::move(tasks[index]);
+    tasks[index] = nullptr;
+    count--;
+    return task;
+}
+
+
+Executor::Executor(size_t nWorkers) {
+    if (nWorkers == 0) {
+        nWorkers = 1;
+    }
+    for (size_t i = 0; i < nWorkers; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < nWorkers; ++i) {
+        threads.emplace_back(&Executor::run, this, i);
+    }
+}
+
+Executor::~Executor() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Executor::post(Task task) {
+    size_t index = currentExecutor == this ?
+        currentWorker :
+        nextWorker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pending++;
+    }
+    wakeUp.notify_one();
+}
+
+bool Executor::pop(size_t index, Task& task) {
+    {
+        Worker& own = *workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.pop_front();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); ++i) {
+        Worker& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::run(size_t index) {
+    currentExecutor = this;
+    currentWorker = index;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this] { return stopping || pending > 0; });
+            if (pending == 0) {
+                return;
+            }
+            pending--;
+        }
+        Task task;
+        while (!pop(index, task)) {
+            std::this_thread::yield();
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            spdlog::error("Unhandled exception in worker {}: {}", index, e.what());
+        }
+    }
+}
+
+
+void Strand::post(Task task) {
+    bool schedule = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        if (!scheduled) {
+            scheduled = true;
+            schedule = true;
+            keepAlive = shared_from_this();
+        }
+    }
+    // The strand keeps itself alive while scheduled, so that the posted task
+    // fits in a Task without allocating, unlike a captured shared_ptr.
+    if (schedule) {
+        executor.post([this]() { drain(); });
+    }
+}
+
+void Strand::drain() {
+    for (int i = 0; i < STRAND_BATCH_SIZE; ++i) {
+        Task task;
+        std::shared_ptr<Strand> self;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (tasks.empty()) {
+                scheduled = false;
+                // Released after the lock, possibly destroying the strand
+                self = std::move(keepAlive);
+                return;
+            }
+            task = tasks.pop_front();
+        }
+        try {
+            task();
+        } catch (const std::exception& e) {
+            spdlog::error("Unhandled exception in strand: {}", e.what());
+        }
+    }
+    executor.post([this]() { drain(); });
+}
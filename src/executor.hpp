@@ -0,0 +1,81 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+using Task = std::function<void()>;
+
+// FIFO of tasks in a ring buffer, which grows to the high-water mark so that
+// steady-state posting does not allocate (a std::deque allocates a block
+// every few tasks).
+class TaskQueue {
+public:
+    bool empty() const { return count == 0; }
+
+    void push_back(Task task);
+    Task pop_front();
+    Task pop_back();
+
+private:
+    std::vector<Task> tasks;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+// Work-stealing thread pool. Each worker owns a queue; tasks posted from a
+// worker go to its own queue, other tasks are spread round-robin. An idle
+// worker steals from the back of the other queues.
+class Executor {
+public:
+    explicit Executor(size_t nWorkers);
+    ~Executor();
+
+    void post(Task task);
+
+    size_t size() const { return workers.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        TaskQueue tasks;
+    };
+
+    void run(size_t index);
+    bool pop(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextWorker{0};
+    std::atomic<size_t> pending{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+};
+
+// Runs its tasks one at a time, in the order they were posted, on an executor.
+// Different strands run in parallel.
+class Strand : public std::enable_shared_from_this<Strand> {
+public:
+    explicit Strand(Executor& executor) : executor(executor) {}
+
+    void post(Task task);
+
+private:
+    void drain();
+
+    Executor& executor;
+    std::mutex mutex;
+    TaskQueue tasks;
+    bool scheduled = false;
+    std::shared_ptr<Strand> keepAlive; // while scheduled
+};
+
+#endif // EXECUTOR_HPP
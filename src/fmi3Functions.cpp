@@ -13,9 +13,22 @@
 #include <thread>
 #include <chrono>
 #include <filesystem>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <optional>
+#include <unordered_map>
+#include <cstring>
 #include "zenoh.hxx"
 #include "fmi3.pb.h"
 #include "fmi3Functions.h"
+#include "liaisonBatch.h"
+#include "codec.hpp"
+#include "payload.hpp"
+#include "localrt.hpp"
+#include "stats.hpp"
 
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
@@ -31,16 +44,79 @@ using json = nlohmann::json;
 #define NOT_IMPLEMENTED \
     return fmi3Error; \
 
-#define DEFINE_FMI3_SET_VALUE_FUNCTION(TYPE) \
+#define MAX_EXCHANGE_GET_VALUES 64
+#define MAX_BATCHED_CALLS 4096
+#define MAX_CACHED_VALUES 65536
+#define MIN_CACHE_SLOTS 64
+#define MAX_EARLY_LOG_BATCHES 64
+
+#define DECODE_PUSHED_VALUES_CASE(TYPE) \
+    case codec::Type::TYPE: \
+        if (bytes.size() >= codec::valuesSize<fmi3##TYPE>(n)) { \
+            fmi3##TYPE* decoded = reinterpret_cast<fmi3##TYPE*>(buffer.data()); \
+            codec::readValues(decoded, codec::bufferData(bytes), n); \
+            received.Store(codec::Type::TYPE, valueReferences, n, decoded); \
+        } \
+        break;
+#define MIN_REGISTERED_VALUE_REFERENCES 8
+#define MAX_REGISTERED_VALUE_REFERENCE_SETS 256
+#define DEFAULT_SHARED_MEMORY_SIZE 16 // MiB
+#define DEFAULT_TIMEOUT_MS 10000
+#define DEFAULT_INSTANTIATE_TIMEOUT_MS 60000
+#define MIN_HEDGE_SAMPLES 100
+
+// Sends a numeric Set or Get with the compact codec when negotiated at instantiation.
+#define COMPACT_SET(TYPE) \
+    if (placeholder->compactEncoding) { \
+        return compactSet(placeholder, codec::Type::TYPE, valueReferences, nValueReferences, values, nValues); \
+    } \
+
+#define COMPACT_GET(TYPE) \
+    if (placeholder->compactEncoding) { \
+        return compactGet(placeholder, codec::Type::TYPE, valueReferences, nValueReferences, values, nValues); \
+    } \
+
+// In the local real-time mode, numeric Set and Get calls use the table shared
+// with the server when all their variables are in it.
+#ifdef LIAISON_LOCAL_RT
+#define LOCAL_SET(TYPE) \
+    if (placeholder->localTableActive && placeholder->LocalSet(codec::Type::TYPE, valueReferences, nValueReferences, values, nValues)) { \
+        return fmi3OK; \
+    } \
+
+#define LOCAL_GET(TYPE) \
+    if (placeholder->localTableActive) { \
+        fmi3Status local_status; \
+        if (placeholder->LocalGet(codec::Type::TYPE, valueReferences, nValueReferences, values, nValues, local_status)) { \
+            return local_status; \
+        } \
+    } \
+
+#else
+#define LOCAL_SET(TYPE)
+#define LOCAL_GET(TYPE)
+#endif
+
+#define NUMERIC_SET(TYPE) \
+    LOCAL_SET(TYPE) \
+    COMPACT_SET(TYPE) \
+
+#define DEFINE_FMI3_SET_VALUE_FUNCTION(TYPE, FIELD, COMPACT) \
 fmi3Status fmi3Set##TYPE( \
     fmi3Instance instance, \
     const fmi3ValueReference valueReferences[], \
     size_t nValueReferences, \
     const fmi3##TYPE values[], \
     size_t nValues) { \
-    proto::fmi3Set##TYPE##InputMessage input; \
+    auto placeholder = reinterpret_cast<Placeholder*>(instance); \
+    COMPACT \
+    placeholder->InvalidateExchangeOutputs(); \
+    placeholder->StartCall(); \
+    bool deferred = placeholder->CanDeferSet() || placeholder->CanBatchCall(); \
+    proto::fmi3Set##TYPE##InputMessage& input = deferred ? \
+        *placeholder->DeferSet()->mutable_##FIELD() : placeholder->CallMessage<proto::fmi3Set##TYPE##InputMessage>(); \
     proto::fmi3StatusMessage output; \
-    SET_INSTANCE_REFERENCE(input, instance); \
+    input.set_instance_index(placeholder->instance_index); \
     for (size_t i = 0; i < nValueReferences; ++i) { \
         input.add_value_references(valueReferences[i]); \
     } \
@@ -49,69 +125,236 @@ fmi3Status fmi3Set##TYPE( \
         input.add_values(values[i]); \
     } \
     input.set_n_values(nValues); \
-    QUERY("fmi3Set"#TYPE, input, output); \
+    if (deferred) { \
+        return placeholder->CallDeferred(); \
+    } \
+    QUERY(fmi3Set##TYPE, input, output); \
     return transformToFmi3Status(output.status()); \
 }
 
-#define DEFINE_FMI3_GET_VALUE_FUNCTION(TYPE) \
-fmi3Status fmi3Get##TYPE( \
-    fmi3Instance instance, \
+// Serves a scalar Get from the outputs pushed after the last step, if no call
+// may have changed them since.
+#define PUSHED_GET(TYPE) \
+    if (placeholder->pushedOutputs && placeholder->pushedOutputs->Lookup(codec::Type::TYPE, valueReferences, nValueReferences, values, nValues, placeholder->pushSequence)) { \
+        return fmi3OK; \
+    } \
+
+// Serves a scalar Get from the values cached since the last call that may
+// have changed them, and caches the values it fetches (see GetCache).
+#define CACHED_GET(TYPE) \
+    if (placeholder->getCache.Usable(nValueReferences, nValues)) { \
+        if (placeholder->getCache.Lookup(codec::Type::TYPE, valueReferences, nValueReferences, values)) { \
+            return fmi3OK; \
+        } \
+        fmi3Status cache_status = getValues##TYPE(placeholder, valueReferences, nValueReferences, values, nValues); \
+        if (cache_status == fmi3OK) { \
+            placeholder->getCache.Store(codec::Type::TYPE, valueReferences, nValueReferences, values); \
+        } \
+        return cache_status; \
+    } \
+
+#define DEFINE_FMI3_GET_VALUE_FUNCTION(TYPE, FIELD) \
+static fmi3Status getValues##TYPE( \
+    Placeholder* placeholder, \
     const fmi3ValueReference valueReferences[], \
     size_t nValueReferences, \
     fmi3##TYPE values[], \
     size_t nValues) { \
-    proto::fmi3Get##TYPE##InputMessage input; \
-    proto::fmi3Get##TYPE##OutputMessage output; \
-    SET_INSTANCE_REFERENCE(input, instance); \
+    COMPACT_GET(TYPE) \
+    placeholder->StartCall(); \
+    auto& input = placeholder->CallMessage<proto::fmi3Get##TYPE##InputMessage>(); \
+    auto& output = placeholder->CallMessage<proto::fmi3Get##TYPE##OutputMessage>(); \
+    input.set_instance_index(placeholder->instance_index); \
     for (size_t i = 0; i < nValueReferences; ++i) { \
         input.add_value_references(valueReferences[i]); \
     } \
     input.set_n_value_references(nValueReferences); \
-    QUERY("fmi3Get"#TYPE, input, output); \
+    EXCHANGE_QUERY_GET(fmi3Get##TYPE, FIELD, input, output); \
     for (size_t i = 0; i < output.values_size(); ++i) { \
         values[i] = output.values(i); \
     } \
     nValues = output.values_size(); \
     return transformToFmi3Status(output.status()); \
+} \
+\
+fmi3Status fmi3Get##TYPE( \
+    fmi3Instance instance, \
+    const fmi3ValueReference valueReferences[], \
+    size_t nValueReferences, \
+    fmi3##TYPE values[], \
+    size_t nValues) { \
+    auto placeholder = reinterpret_cast<Placeholder*>(instance); \
+    LOCAL_GET(TYPE) \
+    PUSHED_GET(TYPE) \
+    CACHED_GET(TYPE) \
+    return getValues##TYPE(placeholder, valueReferences, nValueReferences, values, nValues); \
 }
 
 #define BASE_QUERY(fmi3Function, input, output, errorReturnValue) \
-    std::vector<uint8_t> input_wire(input.ByteSizeLong()); \
-    input.SerializeToArray(input_wire.data(), input_wire.size()); \
-    std::string expr = "rpc/" + placeholder->responderId + "/" + fmi3Function; \
-    zenoh::Session::GetOptions options; \
-    options.target = zenoh::QueryTarget::Z_QUERY_TARGET_ALL; \
-    options.payload = zenoh::Bytes(std::move(input_wire)); \
-    auto replies = placeholder->session->get(expr,"", zenoh::channels::FifoChannel(1), std::move(options)); \
-    auto res = replies.recv(); \
-    if (std::holds_alternative<zenoh::channels::RecvError>(res)) { \
-        if (std::get<zenoh::channels::RecvError>(res) == zenoh::channels::RecvError::Z_DISCONNECTED) { \
-            std::string error_msg = "Exception in " + std::string(fmi3Function) + ": '" + expr + "' is disconnected."; \
-            placeholder->logMessage(placeholder->instanceEnvironment, fmi3Error, "Zenoh", error_msg.c_str()); \
-        } else if (std::get<zenoh::channels::RecvError>(res) == zenoh::channels::RecvError::Z_NODATA) { \
-            std::string error_msg = "Exception in " + std::string(fmi3Function) + ": No data received from '" + expr + "'."; \
-            placeholder->logMessage(placeholder->instanceEnvironment, fmi3Error, "Zenoh", error_msg.c_str()); \
-        } \
+    if (!placeholder->FlushPendingSets()) { \
+        return errorReturnValue; \
+    } \
+    if (!placeholder->Query(RPC_##fmi3Function, input, output)) { \
         return errorReturnValue; \
     } \
-    const auto &sample = std::get<zenoh::Reply>(res).get_ok(); \
-    const auto& output_payload = sample.get_payload(); \
-    std::vector<uint8_t> output_wire = output_payload.as_vector(); \
-    output.ParseFromArray(output_wire.data(), output_wire.size()); \
-
 
 #define QUERY(fmi3Function, input, output) \
+    placeholder->InvalidateExchangeOutputs(); \
     BASE_QUERY(fmi3Function, input, output, fmi3Fatal) \
+    mergeStatus(output, placeholder->TakeDeferredStatus()); \
+
+#define QUERY_GET(fmi3Function, input, output) \
+    BASE_QUERY(fmi3Function, input, output, fmi3Fatal) \
+    mergeStatus(output, placeholder->TakeDeferredStatus()); \
 
 #define QUERY_INSTANCE(fmi3Function, input, output) \
     BASE_QUERY(fmi3Function, input, output, nullptr) \
+    if (output.instance_index() < 0) { \
+        placeholder->logMessage(placeholder->instanceEnvironment, fmi3Fatal, "Liaison", "The server could not register the instance."); \
+        delete placeholder; \
+        return nullptr; \
+    } \
 
 #define QUERY_VOID(fmi3Function, input, output) \
+    placeholder->InvalidateExchangeOutputs(); \
     BASE_QUERY(fmi3Function, input, output,) \
 
+// Serves a Get from the outputs prefetched by the last fmi3DoStep when possible,
+// otherwise sends it together with any deferred Set calls in a single exchange.
+#define EXCHANGE_QUERY_GET(fmi3Function, FIELD, input, output) \
+    bool prefetched = false; \
+    if (placeholder->CanDeferSet()) { \
+        bool recorded = false; \
+        for (int i = 0; i < placeholder->prefetchGetValues.size(); ++i) { \
+            const auto& get_value = placeholder->prefetchGetValues.Get(i); \
+            if (get_value.has_##FIELD() && sameValueReferences(get_value.FIELD(), input)) { \
+                placeholder->prefetchGetValuesRead[i] = true; \
+                recorded = true; \
+                break; \
+            } \
+        } \
+        if (!recorded && placeholder->prefetchGetValues.size() < MAX_EXCHANGE_GET_VALUES) { \
+            *placeholder->prefetchGetValues.Add()->mutable_##FIELD() = input; \
+            placeholder->prefetchGetValuesRead.push_back(true); \
+        } \
+        const auto& get_outputs = placeholder->lastExchange->get_values(); \
+        int n_prefetched = std::min(get_outputs.size(), placeholder->prefetchGetValues.size()); \
+        for (int i = 0; placeholder->exchangeOutputsValid && i < n_prefetched; ++i) { \
+            const auto& get_value = placeholder->prefetchGetValues.Get(i); \
+            if (get_value.has_##FIELD() && get_outputs.Get(i).has_##FIELD() && sameValueReferences(get_value.FIELD(), input)) { \
+                output = get_outputs.Get(i).FIELD(); \
+                prefetched = true; \
+                break; \
+            } \
+        } \
+    } \
+    if (!prefetched && placeholder->pendingExchange->set_values_size() > 0) { \
+        *placeholder->pendingExchange->add_get_values()->mutable_##FIELD() = input; \
+        auto& exchange_output = placeholder->CallMessage<proto::fmi3ExchangeOutputMessage>(); \
+        if (!placeholder->Exchange(exchange_output)) { \
+            return fmi3Fatal; \
+        } \
+        if (exchange_output.get_values_size() > 0) { \
+            std::swap(output, *exchange_output.mutable_get_values(0)->mutable_##FIELD()); \
+        } \
+        mergeStatus(output, exchange_output.status()); \
+    } else if (!prefetched) { \
+        QUERY_GET(fmi3Function, input, output) \
+    } \
+
+// FMI functions served by the Liaison server, with their timeout class and
+// whether they can be retried and hedged. A querier is declared for each one.
+#define FOR_EACH_RPC_FUNCTION(X) \
+    X(fmi3SetDebugLogging, CONTROL, false) \
+    X(fmi3InstantiateCoSimulation, INSTANTIATE, false) \
+    X(fmi3InstantiateModelExchange, INSTANTIATE, false) \
+    X(fmi3InstantiateScheduledExecution, INSTANTIATE, false) \
+    X(fmi3EnterEventMode, CONTROL, false) \
+    X(fmi3EnterInitializationMode, CONTROL, false) \
+    X(fmi3ExitInitializationMode, CONTROL, false) \
+    X(fmi3FreeInstance, CONTROL, false) \
+    X(fmi3RegisterValueReferences, GET_SET, false) \
+    X(fmi3DoStep, DO_STEP, false) \
+    X(fmi3SetFloat32, GET_SET, false) \
+    X(fmi3GetFloat32, GET_SET, true) \
+    X(fmi3SetFloat64, GET_SET, false) \
+    X(fmi3GetFloat64, GET_SET, true) \
+    X(fmi3SetInt8, GET_SET, false) \
+    X(fmi3GetInt8, GET_SET, true) \
+    X(fmi3SetUInt8, GET_SET, false) \
+    X(fmi3GetUInt8, GET_SET, true) \
+    X(fmi3SetInt16, GET_SET, false) \
+    X(fmi3GetInt16, GET_SET, true) \
+    X(fmi3SetUInt16, GET_SET, false) \
+    X(fmi3GetUInt16, GET_SET, true) \
+    X(fmi3SetInt32, GET_SET, false) \
+    X(fmi3GetInt32, GET_SET, true) \
+    X(fmi3SetUInt32, GET_SET, false) \
+    X(fmi3GetUInt32, GET_SET, true) \
+    X(fmi3SetInt64, GET_SET, false) \
+    X(fmi3GetInt64, GET_SET, true) \
+    X(fmi3SetUInt64, GET_SET, false) \
+    X(fmi3GetUInt64, GET_SET, true) \
+    X(fmi3SetBoolean, GET_SET, false) \
+    X(fmi3GetBoolean, GET_SET, true) \
+    X(fmi3SetString, GET_SET, false) \
+    X(fmi3GetString, GET_SET, true) \
+    X(fmi3SetClock, GET_SET, false) \
+    X(fmi3GetClock, GET_SET, false) \
+    X(fmi3SetBinary, GET_SET, false) \
+    X(fmi3GetBinary, GET_SET, true) \
+    X(fmi3Reset, CONTROL, false) \
+    X(fmi3Terminate, CONTROL, false) \
+    X(fmi3Exchange, DO_STEP, false) \
+    X(fmi3BatchExchange, DO_STEP, false) \
+    X(fmi3CallBatch, CONTROL, false) \
+    X(fmi3GetCompact, GET_SET, true) \
+    X(fmi3SetCompact, GET_SET, false) \
+
+#define RPC_FUNCTION_ENUMERATOR(FMI3FUNCTION, CLASS, IDEMPOTENT) RPC_##FMI3FUNCTION,
+#define RPC_FUNCTION_NAME(FMI3FUNCTION, CLASS, IDEMPOTENT) #FMI3FUNCTION,
+#define RPC_FUNCTION_CLASS(FMI3FUNCTION, CLASS, IDEMPOTENT) CLASS,
+#define RPC_FUNCTION_IDEMPOTENT(FMI3FUNCTION, CLASS, IDEMPOTENT) IDEMPOTENT,
+
 // end of MACROS
 
 
+enum RpcFunction {
+    FOR_EACH_RPC_FUNCTION(RPC_FUNCTION_ENUMERATOR)
+    RPC_FUNCTION_COUNT
+};
+
+const char* rpcFunctionNames[RPC_FUNCTION_COUNT] = {
+    FOR_EACH_RPC_FUNCTION(RPC_FUNCTION_NAME)
+};
+
+// Classes of functions with their own timeout in config.json
+enum CallClass {
+    CONTROL,
+    INSTANTIATE,
+    DO_STEP,
+    GET_SET,
+    CALL_CLASS_COUNT
+};
+
+const char* const callClassNames[CALL_CLASS_COUNT] = {"control", "instantiate", "doStep", "getSet"};
+
+const CallClass rpcFunctionClasses[RPC_FUNCTION_COUNT] = {
+    FOR_EACH_RPC_FUNCTION(RPC_FUNCTION_CLASS)
+};
+
+// Functions without side effects, which are retried after a timeout and hedged
+const bool rpcFunctionIdempotent[RPC_FUNCTION_COUNT] = {
+    FOR_EACH_RPC_FUNCTION(RPC_FUNCTION_IDEMPOTENT)
+};
+
+// Round-trip statistics by RPC function: serializing the request, waiting for
+// the reply and parsing it. The server keeps the matching statistics.
+const size_t N_CLIENT_PHASES = 3;
+const char* const CLIENT_PHASES[N_CLIENT_PHASES] = {"encode", "roundTrip", "decode"};
+using RpcStats = stats::CallStatsTable<RPC_FUNCTION_COUNT, N_CLIENT_PHASES>;
+
+
 fmi3Status transformToFmi3Status(proto::Status status) {
     switch (status) {
         case proto::OK: return fmi3OK;
@@ -123,6 +366,103 @@ fmi3Status transformToFmi3Status(proto::Status status) {
     }
 }
 
+template <typename InputMessage>
+bool sameValueReferences(const InputMessage& a, const InputMessage& b) {
+    return a.value_references_size() == b.value_references_size() &&
+        std::equal(a.value_references().begin(), a.value_references().end(), b.value_references().begin());
+}
+
+// A compact Get request holds only the instance, the type and the value references.
+bool sameValueReferences(const std::string& a, const std::string& b) {
+    return a == b;
+}
+
+// FNV-1a hash of a list of value references.
+size_t hashValueReferences(const fmi3ValueReference valueReferences[], size_t nValueReferences) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < nValueReferences; ++i) {
+        hash = (hash ^ valueReferences[i]) * 1099511628211ull;
+    }
+    return static_cast<size_t>(hash);
+}
+
+// Returns the status of a compact reply, ERROR if it is malformed.
+proto::Status compactStatus(const std::string& output) {
+    codec::Header header;
+    if (!codec::readHeader(codec::bufferData(output), output.size(), header)) {
+        return proto::ERROR;
+    }
+    return static_cast<proto::Status>(header.status);
+}
+
+template <typename OutputMessage>
+void mergeStatus(OutputMessage& output, proto::Status status) {
+    output.set_status(std::max(output.status(), status));
+}
+
+void mergeStatus(std::string& output, proto::Status status) {
+    if (output.size() >= codec::HEADER_SIZE) {
+        output[codec::STATUS_OFFSET] = static_cast<char>(std::max(compactStatus(output), status));
+    }
+}
+
+template <typename Message>
+zenoh::Bytes serializeMessage(const Message& message, payload::SharedMemory* sharedMemory) {
+    return payload::serialize(message, sharedMemory);
+}
+
+// A compact request passed as an rvalue is handed over to Zenoh (see
+// payload::fromString).
+zenoh::Bytes serializeMessage(std::string&& compact, payload::SharedMemory* sharedMemory) {
+    return payload::fromString(std::move(compact), sharedMemory);
+}
+
+zenoh::Bytes serializeMessage(const std::string& compact, payload::SharedMemory* sharedMemory) {
+    if (compact.size() < payload::COPY_THRESHOLD && !payload::usesSharedMemory(compact.size(), sharedMemory)) {
+        return zenoh::Bytes(compact);
+    }
+    return payload::write(compact.size(), [&compact](uint8_t* data) {
+        std::memcpy(data, compact.data(), compact.size());
+    }, sharedMemory);
+}
+
+template <typename Message>
+void parseMessage(const zenoh::Bytes& wire, Message& message) {
+    payload::parse(wire, message);
+}
+
+void parseMessage(const zenoh::Bytes& wire, std::string& compact) {
+    payload::View view(wire);
+    compact.assign(reinterpret_cast<const char*>(view.data()), view.size());
+}
+
+// Reply of a compact Get decoded straight from the payload into the caller's values.
+template <typename T>
+struct CompactGetReply {
+    T* values;
+    size_t nValues;
+    proto::Status status = proto::ERROR;
+};
+
+template <typename T>
+void parseMessage(const zenoh::Bytes& wire, CompactGetReply<T>& reply) {
+    payload::View view(wire);
+    codec::Header header;
+    if (!codec::readHeader(view.data(), view.size(), header)) {
+        reply.status = proto::ERROR;
+        return;
+    }
+    reply.status = static_cast<proto::Status>(header.status);
+    if (!codec::decodeGetReply(view.data(), view.size(), header, reply.values, reply.nValues)) {
+        reply.status = std::max(reply.status, proto::ERROR);
+    }
+}
+
+template <typename T>
+void mergeStatus(CompactGetReply<T>& reply, proto::Status status) {
+    reply.status = std::max(reply.status, status);
+}
+
 #ifdef _WIN32
 std::string getBaseDirectory() {
   char path[MAX_PATH] = {0};
@@ -183,103 +523,1256 @@ void printDirectoryContents(const std::string& directoryPath) {
 
 
 
+// Liaison configuration read from 'config.json' next to the shared library.
+struct LiaisonConfig {
+    std::string responderId;
+    std::string zenohConfig;
+    bool useExchange = true;
+    bool batchCalls = true;
+    bool cacheGets = true;
+    bool pushOutputs = false;
+    bool compactEncoding = true;
+    std::string statsFile;
+    size_t sharedMemorySize = 0; // MiB
+    bool localRealTime = false;
+    uint64_t timeouts[CALL_CLASS_COUNT] = {DEFAULT_TIMEOUT_MS, DEFAULT_INSTANTIATE_TIMEOUT_MS, DEFAULT_TIMEOUT_MS, DEFAULT_TIMEOUT_MS}; // ms
+    size_t getRetries = 0;
+    double hedgePercentile = 0; // 0 disables hedging
+};
+
+LiaisonConfig readLiaisonConfig() {
+    std::string baseDirectory = getBaseDirectory();
+    std::string configFilePath = baseDirectory + "/config.json";
+    if (!std::filesystem::exists(configFilePath)) {
+        printDirectoryContents(baseDirectory);
+        throw std::runtime_error("Failed to open config file at: " + configFilePath);
+    }
+    json config;
+    config = json::parse(std::ifstream(configFilePath));
+
+    LiaisonConfig liaisonConfig;
+    liaisonConfig.responderId = config["responderId"];
+    liaisonConfig.useExchange = config.value("exchange", true);
+    liaisonConfig.batchCalls = config.value("batchCalls", true);
+    liaisonConfig.cacheGets = config.value("cacheGets", true);
+    liaisonConfig.pushOutputs = config.value("pushOutputs", false);
+    liaisonConfig.compactEncoding = config.value("encoding", std::string("compact")) == "compact";
+    liaisonConfig.statsFile = config.value("statsFile", std::string());
+    liaisonConfig.sharedMemorySize = config.value("sharedMemorySize", size_t(DEFAULT_SHARED_MEMORY_SIZE));
+    liaisonConfig.localRealTime = config.value("localRealTime", false);
+    if (config.contains("timeouts")) {
+        for (int callClass = 0; callClass < CALL_CLASS_COUNT; ++callClass) {
+            liaisonConfig.timeouts[callClass] = config["timeouts"].value(callClassNames[callClass], liaisonConfig.timeouts[callClass]);
+        }
+    }
+    liaisonConfig.getRetries = config.value("getRetries", size_t(0));
+    liaisonConfig.hedgePercentile = config.value("hedgePercentile", 0.0);
+    if (config.contains("zenohConfig")) {
+        json& zenohConfig = config["zenohConfig"];
+        if (zenohConfig.contains("transport") && 
+        zenohConfig["transport"].contains("link") && 
+        zenohConfig["transport"]["link"].contains("tls")) {
+            json& tls = zenohConfig["transport"]["link"]["tls"];
+            if (tls.contains("connect_certificate")) {
+                tls["connect_certificate"] = baseDirectory + "/" + tls["connect_certificate"].get<std::string>();
+            }
+            if (tls.contains("connect_private_key")) {
+                tls["connect_private_key"] = baseDirectory + "/" + tls["connect_private_key"].get<std::string>();
+            }
+            if (tls.contains("root_ca_certificate")) {
+                tls["root_ca_certificate"] = baseDirectory + "/" + tls["root_ca_certificate"].get<std::string>();
+            }
+        } 
+        liaisonConfig.zenohConfig = zenohConfig.dump();
+    }
+    return liaisonConfig;
+}
+
+// The config is parsed once per loaded shared library.
+const LiaisonConfig& getLiaisonConfig() {
+    static const LiaisonConfig liaisonConfig = readLiaisonConfig();
+    return liaisonConfig;
+}
+
+// Timeouts, retries and hedged requests of an RPC function.
+struct QueryCounters {
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> hedges{0};
+};
+
+// Routes the log messages that the server publishes for each instance, on
+// rpc/<responderId>/fmi3LogMessage/<instanceIndex>, to the logger of the
+// instance. Messages may arrive before the instantiate reply; the last few of
+// unknown instances are kept until the instance is added. Loggers are called
+// under the lock, so no message reaches an instance once it is removed.
+class LogRouter {
+public:
+    void Receive(const zenoh::Sample& sample) {
+        std::string_view key = sample.get_keyexpr().as_string_view();
+        int index;
+        try {
+            index = std::stoi(std::string(key.substr(key.rfind('/') + 1)));
+        } catch (const std::exception&) {
+            return;
+        }
+        proto::logMessageBatch batch;
+        if (!payload::parse(sample.get_payload(), batch)) {
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        auto route = routes.find(index);
+        if (route != routes.end()) {
+            Deliver(route->second, batch);
+            return;
+        }
+        early.emplace_back(index, std::move(batch));
+        if (early.size() > MAX_EARLY_LOG_BATCHES) {
+            early.pop_front();
+        }
+    }
+
+    void Add(int index, fmi3InstanceEnvironment instanceEnvironment, fmi3LogMessageCallback logMessage) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        Route& route = routes[index] = Route{instanceEnvironment, logMessage};
+        for (auto it = early.begin(); it != early.end();) {
+            if (it->first == index) {
+                Deliver(route, it->second);
+                it = early.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void Remove(int index) {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        routes.erase(index);
+    }
+
+private:
+    struct Route {
+        fmi3InstanceEnvironment instanceEnvironment;
+        fmi3LogMessageCallback logMessage;
+    };
+
+    static void Deliver(const Route& route, const proto::logMessageBatch& batch) {
+        if (!route.logMessage) {
+            return;
+        }
+        for (const auto& log_message : batch.messages()) {
+            route.logMessage(
+                route.instanceEnvironment,
+                transformToFmi3Status(log_message.status()),
+                log_message.category().c_str(),
+                log_message.message().c_str()
+            );
+        }
+    }
+
+    std::recursive_mutex mutex;
+    std::unordered_map<int, Route> routes;
+    std::deque<std::pair<int, proto::logMessageBatch>> early;
+};
+
+// Zenoh session shared by all instances created from this shared library, with
+// one querier per RPC function. Queriers target the best matching queryable so
+// that a call is never answered by more than one server, and time out after
+// the timeout of the class of their function. Idempotent functions get a second
+// querier for their hedged queries, which targets all the replicas of the
+// responder ID instead (see Placeholder::ReceiveHedged).
+class SharedSession {
+public:
+    explicit SharedSession(const LiaisonConfig& liaisonConfig)
+        : sharedMemory(createSharedMemory(liaisonConfig))
+        , session(openSession(liaisonConfig))
+        , responderId(liaisonConfig.responderId)
+        , statsFile(liaisonConfig.statsFile) {
+        for (int function = 0; function < RPC_FUNCTION_COUNT; ++function) {
+            keyExprs.push_back("rpc/" + liaisonConfig.responderId + "/" + rpcFunctionNames[function]);
+            timeouts[function] = liaisonConfig.timeouts[rpcFunctionClasses[function]];
+            zenoh::Session::QuerierOptions options;
+            options.target = zenoh::QueryTarget::Z_QUERY_TARGET_BEST_MATCHING;
+            options.timeout_ms = timeouts[function];
+            queriers.push_back(session.declare_querier(zenoh::KeyExpr(keyExprs.back()), std::move(options)));
+            hedgeQueriers.emplace_back();
+            if (rpcFunctionIdempotent[function]) {
+                zenoh::Session::QuerierOptions hedgeOptions;
+                hedgeOptions.target = zenoh::QueryTarget::Z_QUERY_TARGET_ALL;
+                hedgeOptions.consolidation.mode = zenoh::ConsolidationMode::Z_CONSOLIDATION_MODE_NONE;
+                hedgeOptions.timeout_ms = timeouts[function];
+                hedgeQueriers.back().emplace(session.declare_querier(zenoh::KeyExpr(keyExprs.back()), std::move(hedgeOptions)));
+            }
+        }
+        logSubscriber = std::make_unique<zenoh::Subscriber<void>>(session.declare_subscriber(
+            zenoh::KeyExpr("rpc/" + liaisonConfig.responderId + "/fmi3LogMessage/*"),
+            [this](const zenoh::Sample& sample) { logRouter.Receive(sample); },
+            []() {}
+        ));
+    }
+
+    ~SharedSession() {
+        std::move(*logSubscriber).undeclare();
+        logSubscriber.reset();
+        queriers.clear();
+        hedgeQueriers.clear();
+        session.close();
+        WriteStatsFile();
+    }
+
+    // Writes the statistics so far, if a statistics file is configured.
+    void WriteStatsFile() {
+        if (!statsFile.empty()) {
+            WriteStats();
+        }
+    }
+
+    // Keeps the statistics of a freed instance until the session is closed.
+    void AddInstanceStats(int instanceIndex, json instanceStats) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        instanceStats["instanceIndex"] = instanceIndex;
+        freedInstanceStats.push_back(std::move(instanceStats));
+    }
+
+    // Declared before the session, which must be closed first
+    std::unique_ptr<payload::SharedMemory> sharedMemory;
+    zenoh::Session session;
+    std::string responderId;
+    std::vector<std::string> keyExprs;
+    std::vector<zenoh::Querier> queriers;
+    std::vector<std::optional<zenoh::Querier>> hedgeQueriers; // idempotent functions only
+    LogRouter logRouter;
+    std::unique_ptr<zenoh::Subscriber<void>> logSubscriber;
+    uint64_t timeouts[RPC_FUNCTION_COUNT]; // ms
+    std::string statsFile;
+    RpcStats rpcStats;
+    QueryCounters queryCounters[RPC_FUNCTION_COUNT];
+
+private:
+    // Functions without timeouts, retries or hedges are left out.
+    json QueryCountersToJson() const {
+        json result = json::object();
+        for (int function = 0; function < RPC_FUNCTION_COUNT; ++function) {
+            const QueryCounters& counters = queryCounters[function];
+            if (counters.timeouts || counters.retries || counters.hedges) {
+                result[rpcFunctionNames[function]] = {
+                    {"timeouts", counters.timeouts.load()},
+                    {"retries", counters.retries.load()},
+                    {"hedges", counters.hedges.load()}
+                };
+            }
+        }
+        return result;
+    }
+
+    void WriteStats() {
+        json result = {
+            {"responderId", responderId},
+            {"functions", rpcStats.toJson(rpcFunctionNames, CLIENT_PHASES)},
+            {"queries", QueryCountersToJson()},
+            {"instances", freedInstanceStats}
+        };
+        std::ofstream o(statsFile);
+        o << result.dump(4) << std::endl;
+    }
+
+    std::mutex statsMutex;
+    json freedInstanceStats = json::array();
+
+    static zenoh::Session openSession(const LiaisonConfig& liaisonConfig) {
+        zenoh::Config zenohConfig = !liaisonConfig.zenohConfig.empty() ? 
+            zenoh::Config::from_str(liaisonConfig.zenohConfig) : 
+            zenoh::Config::create_default();
+#ifdef LIAISON_SHARED_MEMORY
+        if (liaisonConfig.sharedMemorySize > 0) {
+            payload::enableSharedMemory(zenohConfig);
+        }
+#endif
+        return zenoh::Session::open(std::move(zenohConfig));
+    }
+
+    static std::unique_ptr<payload::SharedMemory> createSharedMemory(const LiaisonConfig& liaisonConfig) {
+#ifdef LIAISON_SHARED_MEMORY
+        if (liaisonConfig.sharedMemorySize > 0) {
+            return std::make_unique<payload::SharedMemory>(liaisonConfig.sharedMemorySize << 20);
+        }
+#endif
+        return nullptr;
+    }
+};
+
+// Time an unused session is kept open, so that instantiating again shortly
+// after the last instance was freed (e.g. between runs) does not reconnect.
+#define SESSION_IDLE_TIME std::chrono::seconds(5)
+
+// Keeps the session shared by the instances of this library. The instances
+// hold references to it; once the last one is freed, the session is closed by
+// a background thread after SESSION_IDLE_TIME, unless an instance takes it
+// again before. A session still open when the library is unloaded or the
+// process exits is left to the OS, since zenoh-c may hang or crash when
+// closed from static destructors.
+class SessionKeeper {
+public:
+    ~SessionKeeper() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            idle.release();
+        }
+        wakeUp.notify_all();
+#ifndef _WIN32
+        if (closer.joinable()) {
+            closer.join();
+        }
+#endif
+    }
+
+    std::shared_ptr<SharedSession> Acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<SharedSession> session = active.lock();
+        if (session) {
+            return session;
+        }
+        SharedSession* shared = idle.release();
+        if (!shared) {
+            try {
+                shared = new SharedSession(getLiaisonConfig());
+            } catch (const zenoh::ZException& e) {
+                throw std::runtime_error(e.what());
+            }
+        }
+        session = std::shared_ptr<SharedSession>(shared, [this](SharedSession* released) { Release(released); });
+        active = session;
+        return session;
+    }
+
+private:
+    // Called when the last instance drops the session.
+    void Release(SharedSession* released) {
+        released->WriteStatsFile();
+        std::unique_ptr<SharedSession> previous;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            // Another session only goes idle if it was reopened while this one
+            // was being released; it is closed right away.
+            previous = std::move(idle);
+            idle.reset(released);
+            idleUntil = std::chrono::steady_clock::now() + SESSION_IDLE_TIME;
+            StartCloser();
+        }
+        wakeUp.notify_all();
+    }
+
+    // The thread runs until the idle session is closed or taken again. On
+    // Windows, it holds a reference to the library until it exits, so that
+    // the library is not unloaded under it.
+    void StartCloser() {
+        if (closerRunning) {
+            return;
+        }
+        closerRunning = true;
+#ifdef _WIN32
+        HMODULE module = NULL;
+        GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCSTR>(&getBaseDirectory), &module);
+        std::thread([this, module]() {
+            CloseWhenIdle();
+            if (module) {
+                FreeLibraryAndExitThread(module, 0);
+            }
+        }).detach();
+#else
+        if (closer.joinable()) {
+            closer.join();
+        }
+        closer = std::thread(&SessionKeeper::CloseWhenIdle, this);
+#endif
+    }
+
+    void CloseWhenIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping && idle) {
+            if (std::chrono::steady_clock::now() < idleUntil) {
+                wakeUp.wait_until(lock, idleUntil);
+                continue;
+            }
+            std::unique_ptr<SharedSession> session = std::move(idle);
+            lock.unlock();
+            session.reset();
+            lock.lock();
+        }
+        closerRunning = false;
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::weak_ptr<SharedSession> active;
+    std::unique_ptr<SharedSession> idle; // no instance left
+    std::chrono::steady_clock::time_point idleUntil;
+    std::thread closer;
+    bool closerRunning = false;
+    bool stopping = false;
+};
+
+std::shared_ptr<SharedSession> acquireSession() {
+    static SessionKeeper keeper;
+    return keeper.Acquire();
+}
+
+
+// Values returned by the scalar Get calls of an instance, by type and value
+// reference. It is cleared by every call that may change a value (Set,
+// DoStep, mode transitions, Reset...) and only enabled for FMUs that the
+// server reports as deterministic.
+class GetCache {
+public:
+    bool enabled = false;
+
+    bool Usable(size_t nValueReferences, size_t nValues) const {
+        return enabled && nValueReferences > 0 && nValueReferences == nValues;
+    }
+
+    template <typename T>
+    bool Lookup(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, T values[]) const {
+        if (count == 0) {
+            return false;
+        }
+        for (size_t i = 0; i < nValueReferences; ++i) {
+            const Slot* slot = Find(Key(type, valueReferences[i]));
+            if (!slot) {
+                return false;
+            }
+            std::memcpy(&values[i], &slot->bits, sizeof(T));
+        }
+        return true;
+    }
+
+    template <typename T>
+    void Store(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, const T values[]) {
+        if (count + nValueReferences > MAX_CACHED_VALUES) {
+            return;
+        }
+        Reserve(count + nValueReferences);
+        for (size_t i = 0; i < nValueReferences; ++i) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &values[i], sizeof(T));
+            Insert(Key(type, valueReferences[i]), bits);
+        }
+    }
+
+    // Starts a new generation: slots of older ones read as empty.
+    void Clear() {
+        count = 0;
+        if (++generation == 0) {
+            std::fill(slots.begin(), slots.end(), Slot{});
+            generation = 1;
+        }
+    }
+
+private:
+    // Flat open-addressing table, kept at most half full. It only grows, to
+    // the high-water mark, so Stores after a Clear do not allocate.
+    struct Slot {
+        uint64_t key = 0;
+        uint64_t bits = 0;
+        uint32_t generation = 0;
+    };
+
+    static uint64_t Key(codec::Type type, fmi3ValueReference valueReference) {
+        return static_cast<uint64_t>(type) << 32 | valueReference;
+    }
+
+    size_t Home(uint64_t key) const {
+        return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+    }
+
+    const Slot* Find(uint64_t key) const {
+        for (size_t i = Home(key); ; i = (i + 1) & mask) {
+            const Slot& slot = slots[i];
+            if (slot.generation != generation) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot;
+            }
+        }
+    }
+
+    void Insert(uint64_t key, uint64_t bits) {
+        for (size_t i = Home(key); ; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.generation != generation) {
+                slot.key = key;
+                slot.bits = bits;
+                slot.generation = generation;
+                ++count;
+                return;
+            }
+            if (slot.key == key) {
+                slot.bits = bits;
+                return;
+            }
+        }
+    }
+
+    void Reserve(size_t n) {
+        if (2 * n <= slots.size()) {
+            return;
+        }
+        size_t size = std::max<size_t>(slots.size(), MIN_CACHE_SLOTS);
+        while (size < 2 * n) {
+            size <<= 1;
+        }
+        std::vector<Slot> previous(size);
+        previous.swap(slots);
+        mask = size - 1;
+        count = 0;
+        for (const Slot& slot : previous) {
+            if (slot.generation == generation) {
+                Insert(slot.key, slot.bits);
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+    uint32_t generation = 1;
+};
+
+// Outputs pushed by the server after each step of an instance. Samples are
+// received on a Zenoh thread, and only the latest one is kept.
+class PushedOutputs {
+public:
+    void Receive(const zenoh::Bytes& payload) {
+        std::lock_guard<std::mutex> receiving(receiveMutex);
+        if (!payload::parse(payload, message)) {
+            return;
+        }
+        received.Clear();
+        for (const auto& values : message.values()) {
+            const std::string& bytes = values.values();
+            const fmi3ValueReference* valueReferences = values.value_references().data();
+            size_t n = values.value_references_size();
+            buffer.resize(n);
+            switch (static_cast<codec::Type>(values.type())) {
+                DECODE_PUSHED_VALUES_CASE(Float32)
+                DECODE_PUSHED_VALUES_CASE(Float64)
+                DECODE_PUSHED_VALUES_CASE(Int8)
+                DECODE_PUSHED_VALUES_CASE(UInt8)
+                DECODE_PUSHED_VALUES_CASE(Int16)
+                DECODE_PUSHED_VALUES_CASE(UInt16)
+                DECODE_PUSHED_VALUES_CASE(Int32)
+                DECODE_PUSHED_VALUES_CASE(UInt32)
+                DECODE_PUSHED_VALUES_CASE(Int64)
+                DECODE_PUSHED_VALUES_CASE(UInt64)
+                DECODE_PUSHED_VALUES_CASE(Boolean)
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (message.sequence() > sequence) {
+            sequence = message.sequence();
+            std::swap(latest, received);
+        }
+    }
+
+    // Reads values of the step with the given sequence number, if received.
+    template <typename T>
+    bool Lookup(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, T values[], size_t nValues, uint64_t stepSequence) {
+        if (stepSequence == 0 || nValueReferences != nValues) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return sequence == stepSequence && latest.Lookup(type, valueReferences, nValueReferences, values);
+    }
+
+private:
+    // The sample being decoded, whose buffers are reused by the next ones
+    std::mutex receiveMutex;
+    proto::fmi3PushedOutputsMessage message;
+    GetCache received;
+    std::vector<uint64_t> buffer;
+
+    std::mutex mutex;
+    uint64_t sequence = 0;
+    GetCache latest;
+};
+
 class Placeholder {
 public:
     Placeholder(fmi3InstanceEnvironment instanceEnvironment, fmi3LogMessageCallback logMessage) 
         : instanceEnvironment(instanceEnvironment)
         , logMessage(logMessage) {
             StartSession();
-            addLogMessageSubscriber(instanceEnvironment, logMessage);
         }
                 
-    int instance_index;
+    int instance_index = -1;
     fmi3InstanceEnvironment instanceEnvironment;
     fmi3LogMessageCallback logMessage;
-    std::unique_ptr<zenoh::Session> session;
-    std::unique_ptr<zenoh::Subscriber<void>> fmi3LogMessageSubscriber;
+    std::shared_ptr<SharedSession> session;
     std::string responderId;
+    RpcStats rpcStats;
+
+    // Wire encoding of numeric Get/Set calls: the compact codec is requested at
+    // instantiation and used if the server accepts it.
+    bool preferCompactEncoding = true;
+    bool compactEncoding = false;
+
+    // Messages of the current call, allocated on callArena (see StartCall),
+    // and the buffers of the compact calls, reused by the next calls.
+    payload::MessageArena callArena;
+    google::protobuf::Arena* currentCallArena = nullptr;
+    std::string compactRequest;
+    std::string compactReply;
+
+    // Replies of the last fmi3GetString and fmi3GetBinary, whose values the
+    // importer reads until the next one. Parsing the next reply reuses the
+    // buffers of their values.
+    proto::fmi3GetStringOutputMessage stringValues;
+    proto::fmi3GetBinaryOutputMessage binaryValues;
+
+    // Buffers of the liaisonDoStepBatch calls this instance sends
+    std::vector<size_t> batchInstances;
+    proto::fmi3BatchExchangeInputMessage batchInput;
+    payload::ArenaMessage<proto::fmi3BatchExchangeOutputMessage> batchOutput;
+
+    // Idempotent calls are sent again up to getRetries times after a timeout,
+    // and hedged with a second query if no reply arrived within the
+    // hedgePercentile of their round trip times (0 disables hedging).
+    size_t getRetries = 0;
+    double hedgePercentile = 0;
+
+    // Random ID of the server holding the instance, which only that server
+    // answers among the replicas reached by a hedged query (0 if unknown).
+    uint64_t serverId = 0;
+
+    // Value reference lists registered with the server for compact calls.
+    struct RegisteredValueReferences {
+        size_t hash;
+        std::vector<fmi3ValueReference> valueReferences;
+        int64_t handle; // -1 if the registration failed
+    };
+    std::vector<RegisteredValueReferences> registeredValueReferences;
+
+    // Exchange: in Step Mode, Set calls are deferred and sent together with the
+    // next fmi3DoStep, which also prefetches the outputs read after the previous step.
+    bool useExchange = true;
+    bool coSimulation = false;
+    bool inStepMode = false;
+    // The Gets read during a step are prefetched by the next one, in their
+    // order of first read; those not read during a step are dropped by the next.
+    payload::ArenaMessage<proto::fmi3ExchangeInputMessage> pendingExchange;
+    google::protobuf::RepeatedPtrField<proto::fmi3GetValueMessage> prefetchGetValues;
+    std::vector<bool> prefetchGetValuesRead;
+    payload::ArenaMessage<proto::fmi3ExchangeOutputMessage> lastExchange;
+    bool exchangeOutputsValid = false;
+    proto::Status deferredStatus = proto::OK;
+
+    // Call batch: outside Step Mode, Set calls and mode transitions are queued
+    // and sent together before the next call that needs a reply.
+    bool batchCalls = true;
+    proto::fmi3CallBatchInputMessage pendingCalls;
+
+    // Get cache, if requested with "cacheGets" and confirmed by the server
+    bool preferGetCache = true;
+    GetCache getCache;
+
+    // Outputs pushed after each step, if requested with "pushOutputs". They
+    // serve the Gets once the DoStep reply has confirmed their step.
+    bool preferPushOutputs = false;
+    std::shared_ptr<PushedOutputs> pushedOutputs;
+    std::unique_ptr<zenoh::Subscriber<void>> pushSubscriber;
+    uint64_t pushSequence = 0; // step of the usable pushed outputs, 0 if none
+
+#ifdef LIAISON_LOCAL_RT
+    // Local real-time mode: requested at instantiation of a co-simulation and
+    // used in Step Mode if the server shares a table (see localrt.hpp).
+    bool preferLocalRealTime = false;
+    std::unique_ptr<localrt::Table> localTable;
+    bool localTableActive = false;
+    bool localInputsDirty = false;  // inputs not yet passed to the FMU
+    bool localOutputsStale = false; // outputs may depend on inputs set since the last step
+    bool localTableStale = false;   // any value may have changed through an RPC
+#endif
 
 
     void StartSession() {
         if (session) {
             return;
         }
+        const LiaisonConfig& config = getLiaisonConfig();
+        responderId = config.responderId;
+        useExchange = config.useExchange;
+        batchCalls = config.batchCalls;
+        preferGetCache = config.cacheGets;
+        preferPushOutputs = config.pushOutputs;
+        preferCompactEncoding = config.compactEncoding;
+        getRetries = config.getRetries;
+        hedgePercentile = config.hedgePercentile;
+#ifdef LIAISON_LOCAL_RT
+        preferLocalRealTime = config.localRealTime;
+#endif
+        session = acquireSession();
+    }
+
+    // The log messages of the instance are routed to its logger from now on.
+    void SetInstanceIndex(int index) {
+        instance_index = index;
+        if (index >= 0) {
+            session->logRouter.Add(index, instanceEnvironment, logMessage);
+        }
+    }
+
+    void SetEncoding(proto::Encoding encoding) {
+        compactEncoding = encoding == proto::COMPACT;
+    }
+
+    void SetDeterministic(bool deterministic) {
+        getCache.enabled = preferGetCache && deterministic;
+    }
+
+    void SubscribePushedOutputs(const std::string& key) {
+        if (key.empty()) {
+            return;
+        }
+        auto outputs = std::make_shared<PushedOutputs>();
         try {
-            std::string baseDirectory = getBaseDirectory();
-            std::string configFilePath = baseDirectory + "/config.json";
-            if (!std::filesystem::exists(configFilePath)) {
-                printDirectoryContents(baseDirectory);
-            throw std::runtime_error("Failed to open config file at: " + configFilePath);
+            pushSubscriber = std::make_unique<zenoh::Subscriber<void>>(session->session.declare_subscriber(
+                zenoh::KeyExpr(key),
+                [outputs](const zenoh::Sample& sample) { outputs->Receive(sample.get_payload()); },
+                []() {}
+            ));
+            pushedOutputs = outputs;
+        } catch (const zenoh::ZException& e) {
+            logMessage(instanceEnvironment, fmi3Warning, "Zenoh", e.what());
+        }
+    }
+
+    // Starts a call whose messages are allocated with CallMessage. The
+    // messages of the previous call are destroyed.
+    void StartCall() {
+        currentCallArena = &callArena.next();
+    }
+
+    template <typename Message>
+    Message& CallMessage() {
+        if (!currentCallArena) {
+            StartCall();
+        }
+        return *google::protobuf::Arena::CreateMessage<Message>(currentCallArena);
+    }
+
+    // Sends a query for fmi3Function and parses the reply into output.
+    // Returns false, after logging the reason, if no reply was received.
+    template <typename InputMessage, typename OutputMessage>
+    bool Query(RpcFunction function, InputMessage&& input, OutputMessage& output) {
+        uint64_t started = stats::now();
+        zenoh::Bytes input_payload = serializeMessage(std::forward<InputMessage>(input), session->sharedMemory.get());
+        size_t bytes_out = input_payload.size();
+        uint64_t encoded = stats::now();
+        std::optional<zenoh::Bytes> output_payload = Receive(function, std::move(input_payload));
+        uint64_t replied = stats::now();
+        if (!output_payload) {
+            return false;
+        }
+        parseMessage(*output_payload, output);
+
+        const uint64_t durations[N_CLIENT_PHASES] = {encoded - started, replied - encoded, stats::now() - replied};
+        rpcStats.get(function).record(durations, output_payload->size(), bytes_out);
+        session->rpcStats.get(function).record(durations, output_payload->size(), bytes_out);
+        return true;
+    }
+
+    enum class QueryError {NONE, TIMEOUT, DISCONNECTED};
+
+    // Sends payload to the queryable of fmi3Function and returns the payload of
+    // the reply. Idempotent calls are hedged and retried as configured.
+    std::optional<zenoh::Bytes> Receive(RpcFunction function, zenoh::Bytes&& payload) {
+        const std::string& expr = session->keyExprs[function];
+        const char* name = rpcFunctionNames[function];
+        QueryCounters& counters = session->queryCounters[function];
+        size_t attempts = rpcFunctionIdempotent[function] ? 1 + getRetries : 1;
+        for (size_t attempt = 1; ; ++attempt) {
+            bool last = attempt == attempts;
+            QueryError error = QueryError::NONE;
+            std::optional<zenoh::Bytes> reply;
+            uint64_t hedgeDelay = HedgeDelay(function);
+            if (hedgeDelay > 0) {
+                reply = ReceiveHedged(function, last ? std::move(payload) : payload.clone(), hedgeDelay, error);
+            } else {
+                reply = ReceiveOnce(function, last ? std::move(payload) : payload.clone(), error);
             }
-            json config;
-            config = json::parse(std::ifstream(configFilePath));
-            responderId = config["responderId"];
-            std::string zenohConfigString;
-            if (config.contains("zenohConfig")) {
-                json& zenohConfig = config["zenohConfig"];
-                if (zenohConfig.contains("transport") && 
-                zenohConfig["transport"].contains("link") && 
-                zenohConfig["transport"]["link"].contains("tls")) {
-                    json& tls = zenohConfig["transport"]["link"]["tls"];
-                    if (tls.contains("connect_certificate")) {
-                        tls["connect_certificate"] = baseDirectory + "/" + tls["connect_certificate"].get<std::string>();
-                    }
-                    if (tls.contains("connect_private_key")) {
-                        tls["connect_private_key"] = baseDirectory + "/" + tls["connect_private_key"].get<std::string>();
-                    }
-                    if (tls.contains("root_ca_certificate")) {
-                        tls["root_ca_certificate"] = baseDirectory + "/" + tls["root_ca_certificate"].get<std::string>();
-                    }
-                } 
-                zenohConfigString = zenohConfig.dump();
+            if (reply) {
+                return reply;
             }
-            zenoh::Config zenohConfig = !zenohConfigString.empty() ? 
-                zenoh::Config::from_str(zenohConfigString) : 
-                zenoh::Config::create_default();
-            session = std::make_unique<zenoh::Session>(zenoh::Session::open(std::move(zenohConfig))); 
-        } catch (const zenoh::ZException& e) {
-            throw std::runtime_error(e.what());
-        }
-    }
-
-    void addLogMessageSubscriber(fmi3InstanceEnvironment instanceEnvironment, fmi3LogMessageCallback logMessage) {
-        auto logMessageCallback = [logMessage, instanceEnvironment](const zenoh::Sample& sample) { 
-            proto::logMessage log_message; 
-            const auto wire = sample.get_payload().as_vector(); 
-            log_message.ParseFromArray(wire.data(), wire.size()); 
-            logMessage( 
-                instanceEnvironment, 
-                transformToFmi3Status(log_message.status()), 
-                log_message.category().c_str(), 
-                log_message.message().c_str() 
-            ); 
-        }; 
-        auto dropCallback = []() { 
+            if (error == QueryError::TIMEOUT) {
+                ++counters.timeouts;
+                if (!last) {
+                    ++counters.retries;
+                    std::string msg = std::string(name) + ": no reply from '" + expr + "' within " + std::to_string(session->timeouts[function]) +
+                        " ms, retrying (" + std::to_string(attempt) + "/" + std::to_string(getRetries) + ").";
+                    logMessage(instanceEnvironment, fmi3Warning, "Liaison", msg.c_str());
+                    continue;
+                }
+                std::string error_msg = "Exception in " + std::string(name) + ": No reply from '" + expr + "' within " + std::to_string(session->timeouts[function]) + " ms.";
+                logMessage(instanceEnvironment, fmi3Error, "Zenoh", error_msg.c_str());
+            } else if (error == QueryError::DISCONNECTED) {
+                std::string error_msg = "Exception in " + std::string(name) + ": '" + expr + "' is disconnected.";
+                logMessage(instanceEnvironment, fmi3Error, "Zenoh", error_msg.c_str());
+            }
+            return std::nullopt;
+        }
+    }
+
+    // A query that ends without a reply once its timeout has elapsed timed out.
+    QueryError NoReplyError(RpcFunction function, uint64_t started) {
+        return stats::now() - started >= session->timeouts[function] * 1000000 ? QueryError::TIMEOUT : QueryError::DISCONNECTED;
+    }
+
+    std::optional<zenoh::Bytes> ReceiveOnce(RpcFunction function, zenoh::Bytes&& payload, QueryError& error) {
+        uint64_t started = stats::now();
+        std::shared_ptr<Replies> replies = TakeReplies(function);
+        SendQuery(function, std::move(payload), replies);
+        std::unique_lock<std::mutex> lock(replies->mutex);
+        replies->changed.wait(lock, [&replies]() { return replies->payload.has_value() || replies->pending == 0; });
+        if (replies->payload) {
+            return std::move(replies->payload);
+        }
+        error = NoReplyError(function, started);
+        return std::nullopt;
+    }
+
+    // Delay in nanoseconds after which an idempotent call is hedged, or 0 if
+    // it is not, including while too few round trips have been measured.
+    uint64_t HedgeDelay(RpcFunction function) {
+        if (hedgePercentile <= 0 || !rpcFunctionIdempotent[function]) {
+            return 0;
+        }
+        const stats::Histogram& roundTrips = session->rpcStats.get(function).phases[1];
+        if (roundTrips.count() < MIN_HEDGE_SAMPLES) {
+            return 0;
+        }
+        return std::max<uint64_t>(1, roundTrips.percentile(hedgePercentile));
+    }
+
+    // Replies to the queries of a call, hedged or not; the first one is kept.
+    struct Replies {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::optional<zenoh::Bytes> payload;
+        int pending = 0;
+    };
+
+    // Replies of the last call of each function, reused by its next call
+    std::shared_ptr<Replies> lastReplies[RPC_FUNCTION_COUNT];
+
+    // The replies of the last call of function are reused once its queries
+    // have been dropped; a query still pending gets new ones.
+    std::shared_ptr<Replies> TakeReplies(RpcFunction function) {
+        std::shared_ptr<Replies>& replies = lastReplies[function];
+        if (replies) {
+            std::lock_guard<std::mutex> lock(replies->mutex);
+            if (replies->pending == 0) {
+                replies->payload.reset();
+                return replies;
+            }
+        }
+        replies = std::make_shared<Replies>();
+        return replies;
+    }
+
+    // Sends a query whose replies are delivered to replies, without a channel.
+    // A hedged query goes to all replicas, with the server ID as attachment.
+    void SendQuery(RpcFunction function, zenoh::Bytes&& payload, const std::shared_ptr<Replies>& replies, bool hedge = false) {
+        {
+            std::lock_guard<std::mutex> lock(replies->mutex);
+            ++replies->pending;
+        }
+        zenoh::Querier::GetOptions options;
+        options.payload = std::move(payload);
+        if (hedge && serverId != 0) {
+            std::vector<uint8_t> id(sizeof(serverId));
+            std::memcpy(id.data(), &serverId, sizeof(serverId));
+            options.attachment = zenoh::Bytes(std::move(id));
+        }
+        const zenoh::Querier& querier = hedge ? *session->hedgeQueriers[function] : session->queriers[function];
+        auto onReply = [replies](const zenoh::Reply& reply) {
+            if (!reply.is_ok()) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(replies->mutex);
+            if (!replies->payload) {
+                replies->payload = reply.get_ok().get_payload().clone();
+                replies->changed.notify_all();
+            }
+        };
+        auto onDrop = [replies]() {
+            std::lock_guard<std::mutex> lock(replies->mutex);
+            --replies->pending;
+            replies->changed.notify_all();
         };
-        std::string expr_fmi3LogMessage = "rpc/" + responderId + "/fmi3LogMessage"; 
-        zenoh::KeyExpr keyexpr_fmi3LogMessage(expr_fmi3LogMessage); 
-        fmi3LogMessageSubscriber = std::make_unique<zenoh::Subscriber<void>>(
-            session->declare_subscriber(keyexpr_fmi3LogMessage, logMessageCallback, dropCallback)
-        ); 
+        try {
+            querier.get("", std::move(onReply), std::move(onDrop), std::move(options));
+        } catch (const zenoh::ZException&) {
+            std::lock_guard<std::mutex> lock(replies->mutex);
+            --replies->pending;
+        }
     }
 
-    void SetInstanceIndex(int index) {
-        instance_index = index;
+    // Sends a second query if the first one has no reply after delay
+    // nanoseconds, and returns the first reply to either. The first query
+    // goes to the best matching queryable like any other call; the second
+    // one to every replica of the responder ID, on their own routes, of which
+    // only the server holding the instance answers. Non-idempotent calls,
+    // such as fmi3DoStep, are never hedged, so they still reach one server.
+    std::optional<zenoh::Bytes> ReceiveHedged(RpcFunction function, zenoh::Bytes&& payload, uint64_t delay, QueryError& error) {
+        uint64_t started = stats::now();
+        std::shared_ptr<Replies> replies = TakeReplies(function);
+        auto answered = [&replies]() { return replies->payload.has_value() || replies->pending == 0; };
+        SendQuery(function, payload.clone(), replies);
+        std::unique_lock<std::mutex> lock(replies->mutex);
+        if (!replies->changed.wait_for(lock, std::chrono::nanoseconds(delay), answered)) {
+            lock.unlock();
+            ++session->queryCounters[function].hedges;
+            std::string msg = std::string(rpcFunctionNames[function]) + ": no reply within " + std::to_string(delay / 1000) + " us, sending a hedged request.";
+            logMessage(instanceEnvironment, fmi3OK, "Liaison", msg.c_str());
+            SendQuery(function, std::move(payload), replies, true);
+            lock.lock();
+        }
+        replies->changed.wait(lock, answered);
+        if (replies->payload) {
+            return std::move(replies->payload);
+        }
+        error = NoReplyError(function, started);
+        return std::nullopt;
+    }
+
+    // Looks up the handle of a list of value references, registering the list
+    // with the server on first use. Returns false if the list is sent inline.
+    bool ValueReferencesHandle(const fmi3ValueReference valueReferences[], size_t nValueReferences, uint32_t& handle) {
+        if (nValueReferences < MIN_REGISTERED_VALUE_REFERENCES) {
+            return false;
+        }
+        size_t hash = hashValueReferences(valueReferences, nValueReferences);
+        for (const auto& registered : registeredValueReferences) {
+            if (registered.hash == hash &&
+                registered.valueReferences.size() == nValueReferences &&
+                std::equal(registered.valueReferences.begin(), registered.valueReferences.end(), valueReferences)) {
+                handle = static_cast<uint32_t>(registered.handle);
+                return registered.handle >= 0;
+            }
+        }
+        if (registeredValueReferences.size() >= MAX_REGISTERED_VALUE_REFERENCE_SETS) {
+            return false;
+        }
+
+        proto::fmi3RegisterValueReferencesMessage input;
+        proto::fmi3ValueReferencesHandleMessage output;
+        input.set_instance_index(instance_index);
+        for (size_t i = 0; i < nValueReferences; ++i) {
+            input.add_value_references(valueReferences[i]);
+        }
+        RegisteredValueReferences registered;
+        registered.hash = hash;
+        registered.valueReferences.assign(valueReferences, valueReferences + nValueReferences);
+        registered.handle = -1;
+        if (Query(RPC_fmi3RegisterValueReferences, input, output) && output.status() == proto::OK) {
+            registered.handle = output.handle();
+        }
+        registeredValueReferences.push_back(std::move(registered));
+
+        handle = static_cast<uint32_t>(registeredValueReferences.back().handle);
+        return registeredValueReferences.back().handle >= 0;
+    }
+
+    bool CanDeferSet() const {
+        return useExchange && inStepMode;
+    }
+
+    bool CanBatchCall() const {
+        return batchCalls && !inStepMode;
+    }
+
+    // Queues a Set call with the exchange in Step Mode, otherwise in the call batch.
+    proto::fmi3SetValueMessage* DeferSet() {
+        if (CanDeferSet()) {
+            return pendingExchange->add_set_values();
+        }
+        return pendingCalls.add_calls()->mutable_set_value();
+    }
+
+    // Status returned by a queued call. A full batch is sent right away.
+    fmi3Status CallDeferred() {
+        if (pendingCalls.calls_size() >= MAX_BATCHED_CALLS && !FlushPendingCalls()) {
+            return fmi3Fatal;
+        }
+        return fmi3OK;
+    }
+
+    // Called before any call that may change the values of the instance.
+    void InvalidateExchangeOutputs() {
+        exchangeOutputsValid = false;
+        getCache.Clear();
+        pushSequence = 0;
+#ifdef LIAISON_LOCAL_RT
+        localTableStale = true;
+#endif
+    }
+
+    void LeaveStepMode() {
+        inStepMode = false;
+#ifdef LIAISON_LOCAL_RT
+        localTableActive = false;
+#endif
+    }
+
+#ifdef LIAISON_LOCAL_RT
+    // Maps the table shared by the server, if any. The exchange is not used
+    // with a table.
+    void OpenLocalTable(const std::string& name) {
+        if (name.empty()) {
+            return;
+        }
+        try {
+            localTable = localrt::Table::open(name);
+            useExchange = false;
+            getCache.enabled = false;
+        } catch (const std::exception& e) {
+            logMessage(instanceEnvironment, fmi3Warning, "Liaison", e.what());
+        }
+    }
+
+    // Runs a command on the server thread of the table. Returns FATAL, after
+    // logging it, if the server is gone.
+    proto::Status LocalCall(localrt::Command command) {
+        uint64_t started = stats::now();
+        if (!localTable->call(command)) {
+            logMessage(instanceEnvironment, fmi3Fatal, "Liaison", "The server of the local table is gone.");
+            localTableActive = false;
+            return proto::FATAL;
+        }
+        if (command == localrt::Command::Step) {
+            const uint64_t durations[N_CLIENT_PHASES] = {0, stats::now() - started, 0};
+            rpcStats.get(RPC_fmi3DoStep).record(durations, 0, 0);
+            session->rpcStats.get(RPC_fmi3DoStep).record(durations, 0, 0);
+        }
+        localInputsDirty = false;
+        if (command != localrt::Command::Apply) {
+            localOutputsStale = false;
+        }
+        if (command == localrt::Command::Sync) {
+            localTableStale = false;
+        }
+        return static_cast<proto::Status>(localTable->header().status);
+    }
+
+    template <typename T>
+    bool LocalSet(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, const T values[], size_t nValues) {
+        if (!localTable->setValues(type, valueReferences, nValueReferences, values, nValues)) {
+            return false;
+        }
+        localInputsDirty = true;
+        localOutputsStale = true;
+        return true;
+    }
+
+    // The table is refreshed first if the values read may be stale.
+    template <typename T>
+    bool LocalGet(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, T values[], size_t nValues, fmi3Status& status) {
+        if (localTableStale || (localOutputsStale && localTable->readsOutput(type, valueReferences, nValueReferences))) {
+            proto::Status synced = LocalCall(localrt::Command::Sync);
+            if (synced == proto::FATAL) {
+                status = fmi3Fatal;
+                return true;
+            }
+            deferredStatus = std::max(deferredStatus, synced);
+        }
+        if (!localTable->getValues(type, valueReferences, nValueReferences, values, nValues)) {
+            return false;
+        }
+        status = transformToFmi3Status(TakeDeferredStatus());
+        return true;
+    }
+#endif
+
+    // Sends the pending exchange (deferred Set calls, and optionally a DoStep and Gets).
+    bool Exchange(proto::fmi3ExchangeOutputMessage& output) {
+        if (!FlushPendingCalls()) {
+            return false;
+        }
+        pendingExchange->set_instance_index(instance_index);
+        bool received = Query(RPC_fmi3Exchange, *pendingExchange, output);
+        pendingExchange.Clear();
+        return received;
+    }
+
+    // Sets up the pending exchange to step the instance, and to prefetch the
+    // outputs that were read after the previous step.
+    void PrepareStepExchange() {
+        int kept = 0;
+        for (int i = 0; i < prefetchGetValues.size(); ++i) {
+            if (prefetchGetValuesRead[i]) {
+                prefetchGetValues.SwapElements(kept++, i);
+            }
+        }
+        if (kept < prefetchGetValues.size()) {
+            prefetchGetValues.DeleteSubrange(kept, prefetchGetValues.size() - kept);
+        }
+        prefetchGetValuesRead.assign(kept, false);
+        *pendingExchange->mutable_get_values() = prefetchGetValues;
+        pendingExchange->set_instance_index(instance_index);
+    }
+
+    // Takes the DoStep results from lastExchange, whose outputs serve the Gets
+    // until the next step.
+    proto::Status TakeStepResults(proto::fmi3DoStepOutputMessage& output) {
+        exchangeOutputsValid = lastExchange->has_do_step();
+        output.Swap(lastExchange->mutable_do_step());
+        pushSequence = output.step_sequence();
+        return std::max(lastExchange->status(), TakeDeferredStatus());
+    }
+
+    // Sends the queued calls, if any, in a single batch. Like the deferred Set
+    // calls, their status is reported with the status of the next call.
+    bool FlushPendingCalls() {
+        if (pendingCalls.calls_size() == 0) {
+            return true;
+        }
+        pendingCalls.set_instance_index(instance_index);
+        proto::fmi3CallBatchOutputMessage output;
+        int nCalls = pendingCalls.calls_size();
+        bool received = Query(RPC_fmi3CallBatch, pendingCalls, output);
+        pendingCalls.Clear();
+        if (!received) {
+            return false;
+        }
+        if (output.status() >= proto::ERROR) {
+            std::string msg = "Deferred call " + std::to_string(output.statuses_size()) + " of " + std::to_string(nCalls) +
+                " failed; the calls after it were not executed.";
+            logMessage(instanceEnvironment, transformToFmi3Status(output.status()), "Liaison", msg.c_str());
+        }
+        deferredStatus = std::max(deferredStatus, output.status());
+        return true;
+    }
+
+    // Sends the deferred calls, if any, before an unrelated call. Their
+    // status is reported with the status of that call (see TakeDeferredStatus).
+    bool FlushPendingSets() {
+        if (!FlushPendingCalls()) {
+            return false;
+        }
+#ifdef LIAISON_LOCAL_RT
+        if (localTableActive && localInputsDirty) {
+            proto::Status status = LocalCall(localrt::Command::Apply);
+            if (status == proto::FATAL) {
+                return false;
+            }
+            deferredStatus = std::max(deferredStatus, status);
+        }
+#endif
+        if (pendingExchange->set_values_size() == 0) {
+            return true;
+        }
+        proto::fmi3ExchangeOutputMessage output;
+        if (!Exchange(output)) {
+            return false;
+        }
+        if (output.status() >= proto::ERROR) {
+            logMessage(instanceEnvironment, transformToFmi3Status(output.status()), "Liaison", "A deferred fmi3Set call failed.");
+        }
+        deferredStatus = std::max(deferredStatus, output.status());
+        return true;
+    }
+
+    proto::Status TakeDeferredStatus() {
+        proto::Status status = deferredStatus;
+        deferredStatus = proto::OK;
+        return status;
     }
 
     ~Placeholder() {
-        if (fmi3LogMessageSubscriber) {
-            std::move(*fmi3LogMessageSubscriber).undeclare();
-            fmi3LogMessageSubscriber.reset();
+        if (session && !session->statsFile.empty()) {
+            session->AddInstanceStats(instance_index, rpcStats.toJson(rpcFunctionNames, CLIENT_PHASES));
         }
-        if (session) {
-            session->close();
+        if (session && instance_index >= 0) {
+            session->logRouter.Remove(instance_index);
         }
+        session.reset();
     }
 
 };
 
 
+// Numeric Set and Get calls with the compact codec. In Step Mode they take part
+// in the exchange like their protobuf counterparts.
+
+template <typename T>
+fmi3Status compactSet(
+    Placeholder* placeholder,
+    codec::Type type,
+    const fmi3ValueReference valueReferences[],
+    size_t nValueReferences,
+    const T values[],
+    size_t nValues) {
+    placeholder->InvalidateExchangeOutputs();
+    uint32_t handle;
+    bool registered = placeholder->ValueReferencesHandle(valueReferences, nValueReferences, handle);
+    bool deferred = placeholder->CanDeferSet() || placeholder->CanBatchCall();
+    std::string& input = deferred ?
+        *placeholder->DeferSet()->mutable_compact() : placeholder->compactRequest;
+    if (registered) {
+        codec::encodeSetRequest(input, type, placeholder->instance_index, handle, values, nValues);
+    } else {
+        codec::encodeSetRequest(input, type, placeholder->instance_index, valueReferences, nValueReferences, values, nValues);
+    }
+    if (deferred) {
+        return placeholder->CallDeferred();
+    }
+    std::string& output = placeholder->compactReply;
+    QUERY(fmi3SetCompact, std::move(input), output)
+    return transformToFmi3Status(compactStatus(output));
+}
+
+template <typename T>
+fmi3Status compactGet(
+    Placeholder* placeholder,
+    codec::Type type,
+    const fmi3ValueReference valueReferences[],
+    size_t nValueReferences,
+    T values[],
+    size_t nValues) {
+    placeholder->StartCall();
+    std::string& input = placeholder->compactRequest;
+    std::string& output = placeholder->compactReply;
+    uint32_t handle;
+    if (placeholder->ValueReferencesHandle(valueReferences, nValueReferences, handle)) {
+        codec::encodeGetRequest(input, type, placeholder->instance_index, handle, nValues);
+    } else {
+        codec::encodeGetRequest(input, type, placeholder->instance_index, valueReferences, nValueReferences, nValues);
+    }
+    // Outside Step Mode the values are decoded from the reply in place
+    if (!placeholder->CanDeferSet()) {
+        CompactGetReply<T> reply{values, nValues};
+        QUERY_GET(fmi3GetCompact, std::move(input), reply)
+        return transformToFmi3Status(reply.status);
+    }
+    EXCHANGE_QUERY_GET(fmi3GetCompact, compact, input, output)
+
+    codec::Header header;
+    const uint8_t* data = codec::bufferData(output);
+    if (!codec::readHeader(data, output.size(), header)) {
+        return fmi3Error;
+    }
+    proto::Status status = static_cast<proto::Status>(header.status);
+    if (!codec::decodeGetReply(data, output.size(), header, values, nValues)) {
+        status = std::max(status, proto::ERROR);
+    }
+    return transformToFmi3Status(status);
+}
+
+
 /***************************************************
  
                 FMI3 Functions
@@ -315,7 +1808,7 @@ fmi3Status fmi3SetDebugLogging(
         input.add_categories(categories[i]); 
     }
     
-    QUERY("fmi3SetDebugLogging", input, output)
+    QUERY(fmi3SetDebugLogging, input, output)
 
     return transformToFmi3Status(output.status());
 }
@@ -351,9 +1844,16 @@ fmi3Instance fmi3InstantiateModelExchange(
     input.set_visible(visible);
     input.set_logging_on(loggingOn);
     
-    QUERY_INSTANCE("fmi3InstantiateModelExchange", input, output)
+    if (placeholder->preferCompactEncoding) {
+        input.add_encodings(proto::COMPACT);
+    }
+
+    QUERY_INSTANCE(fmi3InstantiateModelExchange, input, output)
 
     placeholder->SetInstanceIndex(output.instance_index());
+    placeholder->SetEncoding(output.encoding());
+    placeholder->SetDeterministic(output.deterministic());
+    placeholder->serverId = output.server_id();
     return reinterpret_cast<fmi3Instance>(placeholder);
 }
 
@@ -400,10 +1900,26 @@ fmi3Instance fmi3InstantiateCoSimulation(
     input.set_n_required_intermediate_variables(nRequiredIntermediateVariables);
     
   
-    QUERY_INSTANCE("fmi3InstantiateCoSimulation", input, output)
+    if (placeholder->preferCompactEncoding) {
+        input.add_encodings(proto::COMPACT);
+    }
+#ifdef LIAISON_LOCAL_RT
+    input.set_local_real_time(placeholder->preferLocalRealTime);
+#endif
+    input.set_push_outputs(placeholder->preferPushOutputs);
+
+    QUERY_INSTANCE(fmi3InstantiateCoSimulation, input, output)
    
 
     placeholder->SetInstanceIndex(output.instance_index());
+    placeholder->SetEncoding(output.encoding());
+    placeholder->SetDeterministic(output.deterministic());
+    placeholder->serverId = output.server_id();
+    placeholder->coSimulation = true;
+#ifdef LIAISON_LOCAL_RT
+    placeholder->OpenLocalTable(output.local_table());
+#endif
+    placeholder->SubscribePushedOutputs(output.push_key());
     return reinterpret_cast<fmi3Instance>(placeholder);
 }
 
@@ -440,10 +1956,17 @@ fmi3Instance fmi3InstantiateScheduledExecution(
     // TODO: implement functionality for instanceEnvironment, clockUpdate, lockPeemption, and unlockPreemption
 
        
-    QUERY_INSTANCE("fmi3InstantiateScheduledExecution", input, output)
+    if (placeholder->preferCompactEncoding) {
+        input.add_encodings(proto::COMPACT);
+    }
+
+    QUERY_INSTANCE(fmi3InstantiateScheduledExecution, input, output)
  
 
     placeholder->SetInstanceIndex(output.instance_index());
+    placeholder->SetEncoding(output.encoding());
+    placeholder->SetDeterministic(output.deterministic());
+    placeholder->serverId = output.server_id();
     return reinterpret_cast<fmi3Instance>(placeholder);
 }
 
@@ -456,7 +1979,7 @@ void fmi3FreeInstance(fmi3Instance instance) {
     proto::fmi3InstanceMessage input;
     proto::fmi3StatusMessage output;
     SET_INSTANCE_REFERENCE(input, instance)
-    QUERY_VOID("fmi3FreeInstance", input, output)
+    QUERY_VOID(fmi3FreeInstance, input, output)
 
     // Clean up the placeholder (created by SET_INSTANCE_REFERENCE)
     delete placeholder;
@@ -480,8 +2003,13 @@ fmi3Status fmi3EnterInitializationMode(
     input.set_start_time(startTime);
     input.set_stop_time_defined(stopTimeDefined);
     input.set_stop_time(stopTime);
-    
-    QUERY("fmi3EnterInitializationMode", input, output)
+
+    if (placeholder->CanBatchCall()) {
+        placeholder->InvalidateExchangeOutputs();
+        placeholder->pendingCalls.add_calls()->mutable_enter_initialization_mode()->Swap(&input);
+        return placeholder->CallDeferred();
+    }
+    QUERY(fmi3EnterInitializationMode, input, output)
 
     return transformToFmi3Status(output.status());
 }
@@ -493,8 +2021,29 @@ fmi3Status fmi3ExitInitializationMode(fmi3Instance instance) {
     
     SET_INSTANCE_REFERENCE(input, instance)
 
-    QUERY("fmi3ExitInitializationMode", input, output)
-
+    // Queued unless the local table must be filled once the server has left
+    // Initialization Mode
+    bool batched = placeholder->CanBatchCall();
+#ifdef LIAISON_LOCAL_RT
+    batched = batched && !placeholder->localTable;
+#endif
+    if (batched) {
+        placeholder->InvalidateExchangeOutputs();
+        placeholder->pendingCalls.add_calls()->mutable_exit_initialization_mode()->Swap(&input);
+        placeholder->inStepMode = placeholder->coSimulation;
+        return placeholder->CallDeferred();
+    }
+    QUERY(fmi3ExitInitializationMode, input, output)
+
+    placeholder->inStepMode = placeholder->coSimulation && output.status() <= proto::WARNING;
+#ifdef LIAISON_LOCAL_RT
+    // Fill the table with the values at the start of Step Mode
+    if (placeholder->inStepMode && placeholder->localTable) {
+        proto::Status status = placeholder->LocalCall(localrt::Command::Sync);
+        placeholder->localTableActive = status <= proto::WARNING;
+        mergeStatus(output, status);
+    }
+#endif
     return transformToFmi3Status(output.status());
 }
 
@@ -505,7 +2054,13 @@ fmi3Status fmi3EnterEventMode(fmi3Instance instance) {
 
     SET_INSTANCE_REFERENCE(input, instance)
 
-    QUERY("fmi3EnterEventMode", input, output)
+    if (placeholder->CanBatchCall()) {
+        placeholder->InvalidateExchangeOutputs();
+        placeholder->pendingCalls.add_calls()->mutable_enter_event_mode()->Swap(&input);
+        return placeholder->CallDeferred();
+    }
+    QUERY(fmi3EnterEventMode, input, output)
+    placeholder->LeaveStepMode();
 
     return transformToFmi3Status(output.status());
 }
@@ -516,7 +2071,8 @@ fmi3Status fmi3Terminate(fmi3Instance instance) {
 
     SET_INSTANCE_REFERENCE(input, instance)
     
-    QUERY("fmi3Terminate", input, output)
+    QUERY(fmi3Terminate, input, output)
+    placeholder->LeaveStepMode();
 
     return transformToFmi3Status(output.status());;
 }
@@ -527,7 +2083,8 @@ fmi3Status fmi3Reset(fmi3Instance instance) {
 
     SET_INSTANCE_REFERENCE(input, instance)
     
-    QUERY("fmi3Reset", input, output)
+    QUERY(fmi3Reset, input, output)
+    placeholder->LeaveStepMode();
 
     return transformToFmi3Status(output.status());
 }
@@ -535,40 +2092,42 @@ fmi3Status fmi3Reset(fmi3Instance instance) {
 /* Getting and setting variable values */
 
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Float32)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Float32)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Float32, float32)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Float32, float32, NUMERIC_SET(Float32))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Float64)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Float64)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Float64, float64)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Float64, float64, NUMERIC_SET(Float64))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Int8)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Int8)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Int8, int8)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Int8, int8, NUMERIC_SET(Int8))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(UInt8)
-DEFINE_FMI3_SET_VALUE_FUNCTION(UInt8)
+DEFINE_FMI3_GET_VALUE_FUNCTION(UInt8, uint8)
+DEFINE_FMI3_SET_VALUE_FUNCTION(UInt8, uint8, NUMERIC_SET(UInt8))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Int16)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Int16)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Int16, int16)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Int16, int16, NUMERIC_SET(Int16))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(UInt16)
-DEFINE_FMI3_SET_VALUE_FUNCTION(UInt16)
+DEFINE_FMI3_GET_VALUE_FUNCTION(UInt16, uint16)
+DEFINE_FMI3_SET_VALUE_FUNCTION(UInt16, uint16, NUMERIC_SET(UInt16))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Int32)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Int32)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Int32, int32)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Int32, int32, NUMERIC_SET(Int32))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(UInt32)
-DEFINE_FMI3_SET_VALUE_FUNCTION(UInt32)
+DEFINE_FMI3_GET_VALUE_FUNCTION(UInt32, uint32)
+DEFINE_FMI3_SET_VALUE_FUNCTION(UInt32, uint32, NUMERIC_SET(UInt32))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Int64)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Int64)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Int64, int64)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Int64, int64, NUMERIC_SET(Int64))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(UInt64)
-DEFINE_FMI3_SET_VALUE_FUNCTION(UInt64)
+DEFINE_FMI3_GET_VALUE_FUNCTION(UInt64, uint64)
+DEFINE_FMI3_SET_VALUE_FUNCTION(UInt64, uint64, NUMERIC_SET(UInt64))
 
-DEFINE_FMI3_GET_VALUE_FUNCTION(Boolean)
-DEFINE_FMI3_SET_VALUE_FUNCTION(Boolean)
+DEFINE_FMI3_GET_VALUE_FUNCTION(Boolean, boolean)
+DEFINE_FMI3_SET_VALUE_FUNCTION(Boolean, boolean, NUMERIC_SET(Boolean))
 
-DEFINE_FMI3_SET_VALUE_FUNCTION(String)
+DEFINE_FMI3_SET_VALUE_FUNCTION(String, string, )
+// The values point into the string values of the instance, which stay valid
+// until its next fmi3GetString.
 fmi3Status fmi3GetString(
     fmi3Instance instance,
     const fmi3ValueReference valueReferences[],
@@ -576,21 +2135,23 @@ fmi3Status fmi3GetString(
     fmi3String values[],
     size_t nValues) {
     
-    proto::fmi3GetStringInputMessage input;
-    proto::fmi3GetStringOutputMessage output;
+    auto placeholder = reinterpret_cast<Placeholder*>(instance);
+    placeholder->StartCall();
+    auto& input = placeholder->CallMessage<proto::fmi3GetStringInputMessage>();
+    proto::fmi3GetStringOutputMessage& output = placeholder->stringValues;
 
-    SET_INSTANCE_REFERENCE(input, instance) 
+    input.set_instance_index(placeholder->instance_index);
     for (size_t i = 0; i < nValueReferences; ++i) {
         input.add_value_references(valueReferences[i]); 
     }
     input.set_n_value_references(nValueReferences);
     
-    QUERY("fmi3GetString", input, output)
+    QUERY_GET(fmi3GetString, input, output)
 
-    for (int i = 0; i < output.n_values(); ++i) {
-        values[i] = output.values(i).c_str(); 
+    size_t nReceived = std::min(static_cast<size_t>(output.values_size()), nValues);
+    for (size_t i = 0; i < nReceived; ++i) {
+        values[i] = output.values(static_cast<int>(i)).c_str(); 
     }
-    nValues = output.n_values();
     
     return transformToFmi3Status(output.status());
 }
@@ -603,29 +2164,31 @@ fmi3Status fmi3SetBinary(
     const fmi3Binary values[],
     size_t nValues) {
     
-    proto::fmi3SetBinaryInputMessage input;
+    auto placeholder = reinterpret_cast<Placeholder*>(instance);
+    placeholder->StartCall();
+    auto& input = placeholder->CallMessage<proto::fmi3SetBinaryInputMessage>();
     proto::fmi3StatusMessage output;
 
-    SET_INSTANCE_REFERENCE(input, instance) 
-    
+    input.set_instance_index(placeholder->instance_index);
     for (size_t i = 0; i < nValueReferences; ++i) {
         input.add_value_references(valueReferences[i]);
     }
     input.set_n_value_references(nValueReferences);
 
-    size_t offset = 0;
+    // values is an array of nValues pointers, one per value
+    input.mutable_values()->Reserve(static_cast<int>(nValues));
     for (size_t i = 0; i < nValues; ++i) {
-        std::string binaryValue(reinterpret_cast<const char*>(values + offset), valueSizes[i]);
-        input.add_values(binaryValue);
-        offset += valueSizes[i];
+        input.add_values(values[i], valueSizes[i]);
     }
     input.set_n_values(nValues);
 
-    QUERY("fmi3SetBinary", input, output)
+    QUERY(fmi3SetBinary, input, output)
 
     return transformToFmi3Status(output.status());
 }
 
+// The values point into the binary values of the instance, which stay valid
+// until its next fmi3GetBinary.
 fmi3Status fmi3GetBinary(
     fmi3Instance instance,
     const fmi3ValueReference valueReferences[],
@@ -634,25 +2197,25 @@ fmi3Status fmi3GetBinary(
     fmi3Binary values[],
     size_t nValues) {
 
-    proto::fmi3GetBinaryInputMessage input;
-    proto::fmi3GetBinaryOutputMessage output;
+    auto placeholder = reinterpret_cast<Placeholder*>(instance);
+    placeholder->StartCall();
+    auto& input = placeholder->CallMessage<proto::fmi3GetBinaryInputMessage>();
+    proto::fmi3GetBinaryOutputMessage& output = placeholder->binaryValues;
 
-    SET_INSTANCE_REFERENCE(input, instance) 
-    
+    input.set_instance_index(placeholder->instance_index);
     for (size_t i = 0; i < nValueReferences; ++i) {
         input.add_value_references(valueReferences[i]); 
     }
     input.set_n_value_references(nValueReferences);
+    input.set_n_values(nValues);
     
-    QUERY("fmi3GetBinary", input, output)
+    QUERY_GET(fmi3GetBinary, input, output)
 
-    size_t offset = 0;
-    for (size_t i = 0; i < output.n_values(); ++i) {
-        const std::string& binaryValue = output.values(i);
-        size_t binarySize = binaryValue.size();
-        valueSizes[i] = binarySize;
-        std::memcpy(values + offset, binaryValue.data(), binarySize);
-        offset += binarySize;
+    size_t nReceived = std::min(static_cast<size_t>(output.values_size()), nValues);
+    for (size_t i = 0; i < nReceived; ++i) {
+        const std::string& value = output.values(static_cast<int>(i));
+        valueSizes[i] = value.size();
+        values[i] = reinterpret_cast<fmi3Binary>(value.data());
     }
    
     return transformToFmi3Status(output.status());
@@ -675,7 +2238,7 @@ fmi3Status fmi3SetClock(
     }
     input.set_n_value_references(nValueReferences);
         
-    QUERY("fmi3SetClock", input, output)
+    QUERY(fmi3SetClock, input, output)
 
     return transformToFmi3Status(output.status());
 }
@@ -696,7 +2259,7 @@ fmi3Status fmi3GetClock(
     }
     input.set_n_value_references(nValueReferences);
     
-    QUERY("fmi3GetClock", input, output)
+    QUERY_GET(fmi3GetClock, input, output)
 
     for (int i = 0; i < output.n_values(); ++i) {
         values[i] = output.values(i); 
@@ -931,10 +2494,32 @@ fmi3Status fmi3DoStep(fmi3Instance instance,
     fmi3Boolean* earlyReturn,
     fmi3Float64* lastSuccessfulTime) {
 
-    proto::fmi3DoStepMessage input;
-    proto::fmi3StatusMessage output;
-    
-    SET_INSTANCE_REFERENCE(input, instance) 
+    auto placeholder = reinterpret_cast<Placeholder*>(instance);
+#ifdef LIAISON_LOCAL_RT
+    if (placeholder->localTableActive) {
+        localrt::Header& header = placeholder->localTable->header();
+        header.currentCommunicationPoint = currentCommunicationPoint;
+        header.communicationStepSize = communicationStepSize;
+        header.noSetFMUStatePriorToCurrentPoint = noSetFMUStatePriorToCurrentPoint;
+        header.eventHandlingNeeded = *eventHandlingNeeded;
+        header.terminateSimulation = *terminateSimulation;
+        header.earlyReturn = *earlyReturn;
+        header.lastSuccessfulTime = *lastSuccessfulTime;
+        proto::Status status = placeholder->LocalCall(localrt::Command::Step);
+        *eventHandlingNeeded = header.eventHandlingNeeded;
+        *terminateSimulation = header.terminateSimulation;
+        *earlyReturn = header.earlyReturn;
+        *lastSuccessfulTime = header.lastSuccessfulTime;
+        return transformToFmi3Status(std::max(status, placeholder->TakeDeferredStatus()));
+    }
+#endif
+    placeholder->InvalidateExchangeOutputs();
+    proto::fmi3DoStepMessage direct_input;
+    proto::fmi3DoStepMessage& input = placeholder->useExchange ?
+        *placeholder->pendingExchange->mutable_do_step() : direct_input;
+    proto::fmi3DoStepOutputMessage output;
+
+    input.set_instance_index(placeholder->instance_index);
     input.set_current_communication_point(currentCommunicationPoint);
     input.set_communication_step_size(communicationStepSize);
     input.set_no_set_fmu_state_prior_to_current_point(noSetFMUStatePriorToCurrentPoint);
@@ -943,11 +2528,122 @@ fmi3Status fmi3DoStep(fmi3Instance instance,
     input.set_early_return(*earlyReturn);
     input.set_last_successful_time(*lastSuccessfulTime);
 
-    QUERY("fmi3DoStep", input, output)
-    
+    if (placeholder->useExchange) {
+        placeholder->PrepareStepExchange();
+        placeholder->lastExchange.Clear();
+        if (!placeholder->Exchange(*placeholder->lastExchange)) {
+            return fmi3Fatal;
+        }
+        output.set_status(placeholder->TakeStepResults(output));
+    } else {
+        QUERY(fmi3DoStep, input, output)
+        placeholder->pushSequence = output.step_sequence();
+    }
+
+    *eventHandlingNeeded = output.event_handling_needed();
+    *terminateSimulation = output.terminate_simulation();
+    *earlyReturn = output.early_return();
+    *lastSuccessfulTime = output.last_successful_time();
     return transformToFmi3Status(output.status());
 }
 
+/***************************************************
+Liaison extensions (see liaisonBatch.h)
+****************************************************/
+
+fmi3Status liaisonDoStepBatch(fmi3Instance instances[],
+    size_t nInstances,
+    const fmi3Float64 currentCommunicationPoints[],
+    fmi3Float64 communicationStepSize,
+    fmi3Boolean noSetFMUStatePriorToCurrentPoint,
+    fmi3Boolean eventHandlingNeeded[],
+    fmi3Boolean terminateSimulation[],
+    fmi3Boolean earlyReturn[],
+    fmi3Float64 lastSuccessfulTime[],
+    fmi3Status statuses[]) {
+
+    // Instances that cannot use the exchange are stepped one by one. The
+    // first batched instance sends the query, with its batch buffers.
+    Placeholder* first = nullptr;
+    for (size_t i = 0; i < nInstances; ++i) {
+        auto placeholder = reinterpret_cast<Placeholder*>(instances[i]);
+        if (!placeholder) {
+            statuses[i] = fmi3Error;
+            continue;
+        }
+        bool exchange = placeholder->useExchange;
+#ifdef LIAISON_LOCAL_RT
+        exchange = exchange && !placeholder->localTableActive;
+#endif
+        if (!exchange) {
+            statuses[i] = fmi3DoStep(instances[i], currentCommunicationPoints[i], communicationStepSize, noSetFMUStatePriorToCurrentPoint,
+                &eventHandlingNeeded[i], &terminateSimulation[i], &earlyReturn[i], &lastSuccessfulTime[i]);
+            continue;
+        }
+        placeholder->InvalidateExchangeOutputs();
+        if (!placeholder->FlushPendingCalls()) {
+            statuses[i] = fmi3Fatal;
+            continue;
+        }
+        proto::fmi3DoStepMessage& do_step = *placeholder->pendingExchange->mutable_do_step();
+        do_step.set_instance_index(placeholder->instance_index);
+        do_step.set_current_communication_point(currentCommunicationPoints[i]);
+        do_step.set_communication_step_size(communicationStepSize);
+        do_step.set_no_set_fmu_state_prior_to_current_point(noSetFMUStatePriorToCurrentPoint);
+        do_step.set_event_handling_needed(eventHandlingNeeded[i]);
+        do_step.set_terminate_simulation(terminateSimulation[i]);
+        do_step.set_early_return(earlyReturn[i]);
+        do_step.set_last_successful_time(lastSuccessfulTime[i]);
+        placeholder->PrepareStepExchange();
+        if (!first) {
+            first = placeholder;
+            first->batchInstances.clear();
+        }
+        first->batchInstances.push_back(i);
+    }
+
+    if (first) {
+        // The pending exchanges are lent to the batch message, not copied
+        const std::vector<size_t>& batched = first->batchInstances;
+        proto::fmi3BatchExchangeInputMessage& input = first->batchInput;
+        for (size_t i : batched) {
+            input.mutable_exchanges()->UnsafeArenaAddAllocated(&*reinterpret_cast<Placeholder*>(instances[i])->pendingExchange);
+        }
+        first->batchOutput.Clear();
+        proto::fmi3BatchExchangeOutputMessage& output = *first->batchOutput;
+        bool received = first->Query(RPC_fmi3BatchExchange, input, output) &&
+            output.exchanges_size() == static_cast<int>(batched.size());
+        while (input.exchanges_size() > 0) {
+            input.mutable_exchanges()->UnsafeArenaReleaseLast();
+        }
+        for (size_t k = 0; k < batched.size(); ++k) {
+            size_t i = batched[k];
+            auto placeholder = reinterpret_cast<Placeholder*>(instances[i]);
+            placeholder->pendingExchange.Clear();
+            placeholder->lastExchange.Clear();
+            if (!received) {
+                placeholder->exchangeOutputsValid = false;
+                statuses[i] = fmi3Fatal;
+                continue;
+            }
+            placeholder->lastExchange->Swap(output.mutable_exchanges(static_cast<int>(k)));
+            proto::fmi3DoStepOutputMessage step_output;
+            step_output.set_status(placeholder->TakeStepResults(step_output));
+            eventHandlingNeeded[i] = step_output.event_handling_needed();
+            terminateSimulation[i] = step_output.terminate_simulation();
+            earlyReturn[i] = step_output.early_return();
+            lastSuccessfulTime[i] = step_output.last_successful_time();
+            statuses[i] = transformToFmi3Status(step_output.status());
+        }
+    }
+
+    fmi3Status status = fmi3OK;
+    for (size_t i = 0; i < nInstances; ++i) {
+        status = std::max(status, statuses[i]);
+    }
+    return status;
+}
+
 
 /***************************************************
 Types for Functions for Scheduled Execution
@@ -7,6 +7,7 @@
 #include <unistd.h>
 #endif
 #include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include <unordered_map>
 #include <filesystem>
@@ -14,123 +15,302 @@
 #include <zip.h>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <set>
+#include <map>
+#include <condition_variable>
+#include <fstream>
+#include <type_traits>
+#include <optional>
+#include <cstdlib>
+#include <new>
+#include <random>
 
 #include "zenoh.hxx"
 #include "fmi3.pb.h"
 #include "fmi3Functions.h"
 #include <spdlog/spdlog.h>
 #include "utils.hpp"
+#include "codec.hpp"
+#include "payload.hpp"
+#include "localrt.hpp"
+#include "executor.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+#include "logqueue.hpp"
 
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
 // MACROS
 
-#define MAX_BINARY_SIZE 4096
+#define MAX_VALUE_REFERENCE_SETS 1024
+#define MAX_RPC_FUNCTIONS 64
+#define MAX_POOLED_CALLS 256 // per request type
+#define MAX_ARRAY_VALUES (1 << 20) // values of a Get/Set with array variables
+#define DEFAULT_SHARED_MEMORY_SIZE 64 // MiB
+#define DEFAULT_LOG_RATE 1000 // messages per second and category
+#define LOG_QUEUE_CAPACITY 8192
+#define LOG_FLUSH_INTERVAL std::chrono::milliseconds(10)
+#define LOG_PUBLISHER_IDLE_TIME 10000000000 // ns
 
 
-#define DECLARE_QUERYABLE(FMI3FUNCTION, RESPONDER_ID) \
-    std::string expr_##FMI3FUNCTION = "rpc/" + RESPONDER_ID + "/" + std::string(#FMI3FUNCTION); \
+#define DECLARE_QUERYABLE(FMI3FUNCTION, MODEL) \
+    std::string expr_##FMI3FUNCTION = "rpc/" + MODEL.responderId + "/" + std::string(#FMI3FUNCTION); \
     zenoh::KeyExpr keyexpr_##FMI3FUNCTION(expr_##FMI3FUNCTION); \
     auto on_drop_queryable_##FMI3FUNCTION = []() { spdlog::debug("Destroying queryable for {}",#FMI3FUNCTION); }; \
-    auto queryable_##FMI3FUNCTION = session->declare_queryable(keyexpr_##FMI3FUNCTION, std::function<void(const zenoh::Query&)>(callbacks::FMI3FUNCTION), on_drop_queryable_##FMI3FUNCTION); \
+    size_t rpc_##FMI3FUNCTION = MODEL.rpcNames.size(); \
+    MODEL.rpcNames.push_back(#FMI3FUNCTION); \
+    auto callback_##FMI3FUNCTION = [&MODEL, rpc_##FMI3FUNCTION](const zenoh::Query& query) { callbacks::FMI3FUNCTION(MODEL, rpc_##FMI3FUNCTION, query); }; \
+    MODEL.queryables.push_back(session->declare_queryable(keyexpr_##FMI3FUNCTION, std::function<void(const zenoh::Query&)>(callback_##FMI3FUNCTION), on_drop_queryable_##FMI3FUNCTION)); \
 
 #define PARSE_QUERY(QUERY, INPUT) \
     auto input_payload = QUERY.get_payload(); \
     if (input_payload.has_value()) { \
-        const auto input_wire =  input_payload->get().as_vector(); \
-        INPUT.ParseFromArray(input_wire.data(), input_wire.size()); \
+        payload::parse(input_payload->get(), INPUT); \
     } \
 
 #define SERIALIZE_REPLY(QUERY, OUTPUT) \
-    std::vector<uint8_t> output_wire(OUTPUT.ByteSizeLong()); \
-    OUTPUT.SerializeToArray(output_wire.data(), output_wire.size()); \
-    auto output_payload = zenoh::Bytes(std::move(output_wire)); \
-    QUERY.reply(QUERY.get_keyexpr(), std::move(output_payload)); \
+    QUERY.reply(QUERY.get_keyexpr(), payload::serialize(OUTPUT, sharedMemory.get())); \
 
 // Platform-specific loading/unloading of libraries and symbol resolution
 #ifdef _WIN32
-#define BIND_FMU_LIBRARY_FUNCTION(FMI3FUNCTION) \
-    fmu::FMI3FUNCTION = (FMI3FUNCTION##TYPE*)GetProcAddress(fmuLibrary, #FMI3FUNCTION);
+#define BIND_FMU_LIBRARY_FUNCTION(FMI3FUNCTION, MODEL) \
+    MODEL.fmu.FMI3FUNCTION = (FMI3FUNCTION##TYPE*)GetProcAddress(MODEL.library, #FMI3FUNCTION);
 #else
-#define BIND_FMU_LIBRARY_FUNCTION(FMI3FUNCTION) \
-    fmu::FMI3FUNCTION = (FMI3FUNCTION##TYPE*)dlsym(fmuLibrary, #FMI3FUNCTION); \
-    if (!fmu::FMI3FUNCTION) { \
+#define BIND_FMU_LIBRARY_FUNCTION(FMI3FUNCTION, MODEL) \
+    MODEL.fmu.FMI3FUNCTION = (FMI3FUNCTION##TYPE*)dlsym(MODEL.library, #FMI3FUNCTION); \
+    if (!MODEL.fmu.FMI3FUNCTION) { \
         std::ostringstream oss; \
-        oss << "Unable to load function " << #FMI3FUNCTION << ": " << dlerror(); \
+        oss << "Unable to load function " << #FMI3FUNCTION << " from " << MODEL.fmuPath << ": " << dlerror(); \
         throw std::runtime_error(oss.str()); \
     }
 #endif
 
 
-#define DEFINE_FMI3_GET_VALUE_FUNCTION(TYPE) \
-void fmi3Get##TYPE(const zenoh::Query& query) { \
+// The query is parsed on the Zenoh thread into a pooled call and handled on
+// the strand of its instance, with the reply on the arena of the thread.
+#define DEFINE_QUERY_CALLBACK(FMI3FUNCTION, INPUT_TYPE, OUTPUT_TYPE) \
+void FMI3FUNCTION(Model& model, size_t rpc, const zenoh::Query& query) { \
+    uint64_t received = stats::now(); \
+    uint64_t allocated = stats::allocations(); \
     printQuery(query); \
+    if (!answersQuery(query)) { \
+        return; \
+    } \
 \
-    proto::fmi3Get##TYPE##InputMessage input; \
-    PARSE_QUERY(query, input) \
+    PendingCall<INPUT_TYPE>* call = PendingCall<INPUT_TYPE>::acquire(model, rpc); \
+    PARSE_QUERY(query, call->input) \
+    call->bytesIn = payloadSize(query); \
+    call->query.emplace(query.clone()); \
+    call->instanceIndex = instanceIndexOf(call->input, 0); \
+    call->received = received; \
+    call->decoded = stats::now(); \
+    call->decodeAllocations = stats::allocations() - allocated; \
+    int instance_index = call->instanceIndex; \
+    allocated = stats::allocations(); \
+    dispatch(model, instance_index, [call]() { \
+        typename PendingCall<INPUT_TYPE>::Handle handle(call); \
+        uint64_t started = stats::now(); \
+        uint64_t allocated = stats::allocations(); \
+        OUTPUT_TYPE* output = google::protobuf::Arena::CreateMessage<OUTPUT_TYPE>(&replyArena.next()); \
+        try { \
+            handlers::FMI3FUNCTION(*call->model, call->input, *output); \
+        } catch (const std::exception& e) { \
+            spdlog::error("{} for instance {} failed: {}", #FMI3FUNCTION, call->instanceIndex, e.what()); \
+            output->Clear(); \
+            setErrorStatus(*output, 0); \
+        } \
+        uint64_t handled = stats::now(); \
+        uint64_t handlerAllocations = stats::allocations() - allocated; \
 \
-    std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]); \
-    for (int i = 0; i < input.n_value_references(); i++) { \
-        value_references[i] = input.value_references()[i]; \
+        SERIALIZE_REPLY((*call->query), (*output)) \
+        call->query.reset(); \
+        recordCall(*call->model, call->rpc, call->instanceIndex, {call->decoded - call->received, started - call->decoded, handled - started, stats::now() - handled}, call->bytesIn, output->GetCachedSize()); \
+        recordAllocations(*call->model, call->rpc, call->instanceIndex, {call->decodeAllocations, 0, handlerAllocations, stats::allocations() - allocated - handlerAllocations}); \
+    }); \
+    if (executor) { \
+        recordAllocations(model, rpc, instance_index, {0, stats::allocations() - allocated, 0, 0}); \
+    } \
+}
+
+// The value references and values are passed to the FMU in place when their
+// repeated field has the layout of the FMI type (see inPlaceValues).
+#define DEFINE_FMI3_GET_VALUE_FUNCTION(TYPE) \
+void fmi3Get##TYPE(Model& model, const proto::fmi3Get##TYPE##InputMessage& input, proto::fmi3Get##TYPE##OutputMessage& output) { \
+    if (input.value_references_size() < input.n_value_references()) { \
+        output.set_status(proto::ERROR); \
+        return; \
     } \
-    std::unique_ptr<fmi3##TYPE[]> values(new fmi3##TYPE[input.n_value_references()]); \
     size_t nValues = input.n_value_references(); \
+    bool converted; \
+    fmi3##TYPE* values = outputValues<fmi3##TYPE>(*output.mutable_values(), nValues, converted); \
 \
-    fmi3Status status = fmu::fmi3Get##TYPE( \
-        getInstance(input.instance_index()), \
-        value_references.get(), \
+    fmi3Status status = model.fmu.fmi3Get##TYPE( \
+        getInstance(model, input.instance_index()), \
+        valueReferencesOf(input), \
         input.n_value_references(), \
-        values.get(), \
+        values, \
         nValues \
     ); \
 \
-    proto::fmi3Get##TYPE##OutputMessage output; \
-    for (int i = 0; i < input.n_value_references(); i++) { \
+    for (size_t i = 0; converted && i < nValues; i++) { \
         output.add_values(values[i]); \
     } \
     output.set_n_values(nValues); \
     output.set_status(transformToProtoStatus(status)); \
-\
-    SERIALIZE_REPLY(query, output) \
 }
 
 #define DEFINE_FMI3_SET_VALUE_FUNCTION(TYPE) \
-void fmi3Set##TYPE(const zenoh::Query& query) { \
-    printQuery(query); \
-\
-    proto::fmi3Set##TYPE##InputMessage input; \
-    PARSE_QUERY(query, input); \
-\
-    std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]); \
-    for (int i = 0; i < input.n_value_references(); i++) { \
-        value_references[i] = input.value_references()[i]; \
-    } \
-    std::unique_ptr<fmi3##TYPE[]> values(new fmi3##TYPE[input.n_value_references()]); \
-    for (int i = 0; i < input.n_value_references(); i++) { \
-        values[i] = input.values()[i]; \
+void fmi3Set##TYPE(Model& model, const proto::fmi3Set##TYPE##InputMessage& input, proto::fmi3StatusMessage& output) { \
+    if (input.value_references_size() < input.n_value_references() || input.values_size() < input.n_values()) { \
+        output.set_status(proto::ERROR); \
+        return; \
     } \
+    const fmi3##TYPE* values = inPlaceValues<fmi3##TYPE>(input.values()); \
 \
-    fmi3Status status = fmu::fmi3Set##TYPE( \
-        getInstance(input.instance_index()), \
-        value_references.get(), \
+    fmi3Status status = model.fmu.fmi3Set##TYPE( \
+        getInstance(model, input.instance_index()), \
+        valueReferencesOf(input), \
         input.n_value_references(), \
-        values.get(), \
+        values, \
         input.n_values() \
     ); \
 \
-    proto::fmi3StatusMessage output = makeFmi3StatusMessage(status); \
-    SERIALIZE_REPLY(query, output) \
+    output.set_status(transformToProtoStatus(status)); \
 }
 
+#define DEFINE_FMI3_VALUE_QUERY_CALLBACKS(TYPE) \
+    DEFINE_QUERY_CALLBACK(fmi3Get##TYPE, proto::fmi3Get##TYPE##InputMessage, proto::fmi3Get##TYPE##OutputMessage) \
+    DEFINE_QUERY_CALLBACK(fmi3Set##TYPE, proto::fmi3Set##TYPE##InputMessage, proto::fmi3StatusMessage)
+
+#define DEFINE_COMPACT_QUERY_CALLBACK(FMI3FUNCTION) \
+void FMI3FUNCTION(Model& model, size_t rpc, const zenoh::Query& query) { \
+    uint64_t received = stats::now(); \
+    uint64_t allocated = stats::allocations(); \
+    printQuery(query); \
+    if (!answersQuery(query)) { \
+        return; \
+    } \
+\
+    PendingCall<payload::View>* call = PendingCall<payload::View>::acquire(model, rpc); \
+    call->query.emplace(query.clone()); \
+    auto input_payload = call->query->get_payload(); \
+    if (input_payload.has_value()) { \
+        call->input.assign(input_payload->get()); \
+    } \
+    codec::Header header; \
+    call->instanceIndex = codec::readHeader(call->input.data(), call->input.size(), header) ? header.instance_index : -1; \
+    call->bytesIn = call->input.size(); \
+    call->received = received; \
+    call->decoded = stats::now(); \
+    call->decodeAllocations = stats::allocations() - allocated; \
+    int instance_index = call->instanceIndex; \
+    allocated = stats::allocations(); \
+    dispatch(model, instance_index, [call]() { \
+        PendingCall<payload::View>::Handle handle(call); \
+        uint64_t started = stats::now(); \
+        uint64_t allocated = stats::allocations(); \
+        thread_local std::string output; \
+        output.clear(); \
+        try { \
+            handlers::FMI3FUNCTION(*call->model, call->input.data(), call->input.size(), output); \
+        } catch (const std::exception& e) { \
+            spdlog::error("{} for instance {} failed: {}", #FMI3FUNCTION, call->instanceIndex, e.what()); \
+            codec::Header header; \
+            codec::readHeader(call->input.data(), call->input.size(), header); \
+            output.clear(); \
+            codec::encodeStatusReply(output, header.type, proto::ERROR); \
+        } \
+        uint64_t handled = stats::now(); \
+        uint64_t handlerAllocations = stats::allocations() - allocated; \
+        size_t bytes_out = output.size(); \
+\
+        call->query->reply(call->query->get_keyexpr(), payload::fromString(std::move(output), sharedMemory.get())); \
+        call->input.clear(); \
+        call->query.reset(); \
+        recordCall(*call->model, call->rpc, call->instanceIndex, {call->decoded - call->received, started - call->decoded, handled - started, stats::now() - handled}, call->bytesIn, bytes_out); \
+        recordAllocations(*call->model, call->rpc, call->instanceIndex, {call->decodeAllocations, 0, handlerAllocations, stats::allocations() - allocated - handlerAllocations}); \
+    }); \
+    if (executor) { \
+        recordAllocations(model, rpc, instance_index, {0, stats::allocations() - allocated, 0, 0}); \
+    } \
+}
+
+#define COMPACT_GET_CASE(TYPE) \
+    case codec::Type::TYPE: \
+        getCompactValues<fmi3##TYPE>(model, model.fmu.fmi3Get##TYPE, header, input, size, output); \
+        return;
+
+#define COMPACT_SET_CASE(TYPE) \
+    case codec::Type::TYPE: \
+        setCompactValues<fmi3##TYPE>(model, model.fmu.fmi3Set##TYPE, header, input, size, output); \
+        return;
+
+#define EXCHANGE_SET_VALUE(TYPE, FIELD) \
+    if (set_value.has_##FIELD()) { \
+        fmi3Set##TYPE(model, set_value.FIELD(), set_output); \
+    }
+
+#define EXCHANGE_GET_VALUE(TYPE, FIELD) \
+    if (get_value.has_##FIELD()) { \
+        fmi3Get##TYPE(model, get_value.FIELD(), *get_output.mutable_##FIELD()); \
+    }
+
+#define FOR_EACH_SCALAR_TYPE(X) \
+    X(Float32) X(Float64) X(Int8) X(UInt8) X(Int16) X(UInt16) X(Int32) X(UInt32) X(Int64) X(UInt64) X(Boolean)
+
+#define PUSH_OUTPUTS_CASE(TYPE) \
+    case codec::Type::TYPE: \
+        status = std::max(status, readPushedValues<fmi3##TYPE>(model.fmu.fmi3Get##TYPE, slot.instance, values, pushed.buffer)); \
+        break;
+
+#define APPLY_LOCAL_INPUTS(TYPE) \
+    status = std::max(status, applyLocalInputs<fmi3##TYPE>(rt, model.fmu.fmi3Set##TYPE, instance, codec::Type::TYPE));
+
+#define READ_LOCAL_VALUES(TYPE) \
+    status = std::max(status, readLocalValues<fmi3##TYPE>(rt, model.fmu.fmi3Get##TYPE, instance, indices[static_cast<size_t>(codec::Type::TYPE)]));
+
 // end of MACROS
 
-std::unique_ptr<fmi3String> resourcePath;
 std::unique_ptr<zenoh::Session> session;
-std::unique_ptr<zenoh::Publisher> fmi3LogMessagePublisher;
+
+#ifdef LIAISON_COUNT_ALLOCATIONS
+// Counts the heap allocations of each thread for the call statistics. The
+// array and nothrow forms of operator new call this one.
+thread_local uint64_t stats::threadAllocations = 0;
+
+void* operator new(std::size_t size) {
+    ++stats::threadAllocations;
+    if (void* pointer = std::malloc(size > 0 ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+#endif
+
+// Shared memory for replies to clients on the same host (LIAISON_SHARED_MEMORY)
+std::unique_ptr<payload::SharedMemory> sharedMemory;
+
+// Random ID of this server, returned with every instance, which tells the
+// replicas of a responder ID apart in hedged queries.
+uint64_t serverId = 0;
 
 // Function to load and unload FMU library (platform-specific)
 #ifdef _WIN32
+typedef HMODULE FmuLibraryHandle;
+
 HMODULE loadFmuLibrary(const std::string& libPath) {
     HMODULE handle = LoadLibraryA(libPath.c_str());
     if (!handle) {
@@ -156,6 +336,8 @@ void unloadFmuLibrary(HMODULE handle) {
     FreeLibrary(handle);
 }
 #else
+typedef void* FmuLibraryHandle;
+
 void* loadFmuLibrary(const std::string& libPath) {
     void* handle = dlopen(libPath.c_str(), RTLD_LAZY);
     if (!handle) {
@@ -172,9 +354,363 @@ void unloadFmuLibrary(void* handle) {
 #endif
 
 
-// Map that holds the FMU instances
-std::unordered_map<int, fmi3Instance> instances;
-int nextIndex = 0;
+// Functions of an FMU library
+struct FmuFunctions {
+    fmi3SetDebugLoggingTYPE* fmi3SetDebugLogging;
+    fmi3InstantiateCoSimulationTYPE* fmi3InstantiateCoSimulation;
+    fmi3InstantiateModelExchangeTYPE* fmi3InstantiateModelExchange;
+    fmi3InstantiateScheduledExecutionTYPE* fmi3InstantiateScheduledExecution;
+    fmi3EnterEventModeTYPE* fmi3EnterEventMode;
+    fmi3EnterInitializationModeTYPE* fmi3EnterInitializationMode;
+    fmi3ExitInitializationModeTYPE* fmi3ExitInitializationMode;
+    fmi3FreeInstanceTYPE* fmi3FreeInstance;
+    fmi3DoStepTYPE* fmi3DoStep;
+    fmi3SetFloat32TYPE* fmi3SetFloat32;
+    fmi3GetFloat32TYPE* fmi3GetFloat32;
+    fmi3SetFloat64TYPE* fmi3SetFloat64;
+    fmi3GetFloat64TYPE* fmi3GetFloat64;
+    fmi3SetInt8TYPE* fmi3SetInt8;
+    fmi3GetInt8TYPE* fmi3GetInt8;
+    fmi3SetUInt8TYPE* fmi3SetUInt8;
+    fmi3GetUInt8TYPE* fmi3GetUInt8;
+    fmi3SetInt16TYPE* fmi3SetInt16;
+    fmi3GetInt16TYPE* fmi3GetInt16;
+    fmi3SetUInt16TYPE* fmi3SetUInt16;
+    fmi3GetUInt16TYPE* fmi3GetUInt16;
+    fmi3SetInt32TYPE* fmi3SetInt32;
+    fmi3GetInt32TYPE* fmi3GetInt32;
+    fmi3SetUInt32TYPE* fmi3SetUInt32;
+    fmi3GetUInt32TYPE* fmi3GetUInt32;
+    fmi3SetInt64TYPE* fmi3SetInt64;
+    fmi3GetInt64TYPE* fmi3GetInt64;
+    fmi3SetUInt64TYPE* fmi3SetUInt64;
+    fmi3GetUInt64TYPE* fmi3GetUInt64;
+    fmi3SetBooleanTYPE* fmi3SetBoolean;
+    fmi3GetBooleanTYPE* fmi3GetBoolean;
+    fmi3SetStringTYPE* fmi3SetString;
+    fmi3GetStringTYPE* fmi3GetString;
+    fmi3SetClockTYPE* fmi3SetClock;
+    fmi3GetClockTYPE* fmi3GetClock;
+    fmi3SetBinaryTYPE* fmi3SetBinary;
+    fmi3GetBinaryTYPE* fmi3GetBinary;
+    fmi3ResetTYPE* fmi3Reset;
+    fmi3TerminateTYPE* fmi3Terminate;
+};
+
+// Call statistics by queryable, with one histogram per phase of a call: parsing
+// on the Zenoh thread, waiting for a worker, the handler (mostly the FMU) and
+// serializing the reply.
+const size_t N_SERVER_PHASES = 4;
+const char* const SERVER_PHASES[N_SERVER_PHASES] = {"decode", "queue", "fmu", "encode"};
+using RpcStats = stats::CallStatsTable<MAX_RPC_FUNCTIONS, N_SERVER_PHASES>;
+
+struct Model;
+
+// Instance environment of an FMU instance, which tells the logger callback
+// where to publish the messages of the instance. The index is -1 while the
+// instance is not used by a client (e.g. warm in a pool).
+struct InstanceEnvironment {
+    Model* model = nullptr;
+    std::atomic<int> index{-1};
+};
+
+// Warm instances of a model created with the same instantiation arguments.
+struct InstancePool {
+    std::function<fmi3Instance()> instantiate;
+    std::vector<fmi3Instance> warm;
+    bool refilling = false;
+};
+
+// An FMU served under a responder ID. Instantiation, and every call if the
+// FMU cannot run instances in parallel, runs on the strand of the model.
+struct Model {
+    std::string fmuPath;
+    std::string responderId;
+    std::string tempPath;
+    std::string resourcePath;
+    FmuLibraryHandle library = nullptr;
+    FmuFunctions fmu{};
+    bool parallelInstances = true;
+    bool deterministic = false;
+    bool arrayVariables = false;
+    std::shared_ptr<Strand> strand;
+
+    // Scalar outputs by type, pushed after each step to the clients that ask
+    std::vector<fmi3ValueReference> outputs[codec::N_TYPES];
+    std::vector<zenoh::Queryable<void>> queryables;
+
+    // Instance environments given to the FMU, by instance
+    std::mutex environmentsMutex;
+    std::unordered_map<fmi3Instance, std::unique_ptr<InstanceEnvironment>> environments;
+
+    // Pre-instantiated instances, by instantiation arguments
+    size_t poolSize = 0;
+    std::mutex poolMutex;
+    std::unordered_map<std::string, InstancePool> pools;
+    std::atomic<uint64_t> poolHits{0};
+    std::atomic<uint64_t> poolMisses{0};
+
+    // Scalar inputs and outputs shared in the local real-time mode
+    std::vector<localrt::VariableInfo> localVariables;
+
+    // Call statistics of the model and of its live instances
+    std::vector<std::string> rpcNames;
+    RpcStats rpcStats;
+    std::mutex statsMutex;
+    std::map<int, std::shared_ptr<RpcStats>> instanceStats;
+};
+
+// Value references registered with fmi3RegisterValueReferences, with a buffer
+// for their values (8 bytes per value fits every numeric type). The handle of
+// a set is its position in the vector of its instance.
+struct ValueReferenceSet {
+    std::vector<fmi3ValueReference> valueReferences;
+    std::vector<uint64_t> values;
+};
+
+#ifdef LIAISON_LOCAL_RT
+// Local real-time mode of an instance (see localrt.hpp). The commands of the
+// client run on a dedicated thread, which waits on the futex of the table.
+struct LocalRealTime {
+    std::unique_ptr<localrt::Table> table;
+    std::vector<uint32_t> inputs[localrt::N_TYPES]; // variable indices by type
+    std::vector<uint32_t> outputs[localrt::N_TYPES];
+    std::vector<fmi3ValueReference> valueReferences;
+    std::vector<uint64_t> values;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    ~LocalRealTime() {
+        stopping = true;
+        if (table) {
+            table->interrupt();
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+};
+#else
+struct LocalRealTime {};
+#endif
+
+// Outputs of an instance published after each successful step, for a client
+// that requested them at instantiation.
+struct PushedOutputs {
+    std::unique_ptr<zenoh::Publisher> publisher;
+    proto::fmi3PushedOutputsMessage message;
+    std::vector<uint64_t> buffer; // values of one type
+};
+
+// State of an FMU instance. Slots are reused after fmi3FreeInstance, so the
+// strand and the buffers of the value reference sets are kept.
+struct InstanceSlot {
+    Model* model = nullptr;
+    fmi3Instance instance = nullptr;
+    std::string poolKey;
+    std::shared_ptr<RpcStats> stats;
+    std::vector<ValueReferenceSet> valueReferenceSets;
+    std::shared_ptr<Strand> strand;
+    std::unique_ptr<LocalRealTime> localRealTime;
+    std::unique_ptr<PushedOutputs> pushedOutputs;
+};
+
+// Registry that holds the FMU instances of all models. The instance index
+// sent to the clients is the handle of the slot.
+Registry<InstanceSlot> instances;
+
+// Workers running the handlers of all models. The calls of an instance run in
+// order on its strand. Without an executor, handlers run on the Zenoh threads.
+std::unique_ptr<Executor> executor;
+
+// Set at shutdown, before the workers stop: pools are no longer refilled.
+std::atomic<bool> poolRefillsStopped{false};
+
+// Returns the slot of an instance of the model, or nullptr.
+InstanceSlot* findInstanceSlot(const Model& model, int index) {
+    InstanceSlot* slot = instances.get(index);
+    return slot && slot->model == &model ? slot : nullptr;
+}
+
+void dispatch(Model& model, int instanceIndex, Task task) {
+    if (!executor) {
+        task();
+        return;
+    }
+    std::shared_ptr<Strand> strand = model.strand;
+    InstanceSlot* slot = findInstanceSlot(model, instanceIndex);
+    if (slot && model.parallelInstances) {
+        strand = slot->strand;
+    }
+    strand->post(std::move(task));
+}
+
+// Runs on the strand of the instance, like the call.
+void recordCall(Model& model, size_t rpc, int instanceIndex, const uint64_t (&durations)[N_SERVER_PHASES], size_t bytesIn, size_t bytesOut) {
+    model.rpcStats.get(rpc).record(durations, bytesIn, bytesOut);
+    InstanceSlot* slot = findInstanceSlot(model, instanceIndex);
+    if (slot && slot->stats) {
+        slot->stats->get(rpc).record(durations, bytesIn, bytesOut);
+    }
+}
+
+// Heap allocations of each phase of a call, with LIAISON_COUNT_ALLOCATIONS.
+void recordAllocations(Model& model, size_t rpc, int instanceIndex, const uint64_t (&counts)[N_SERVER_PHASES]) {
+#ifdef LIAISON_COUNT_ALLOCATIONS
+    model.rpcStats.get(rpc).recordAllocations(counts);
+    InstanceSlot* slot = findInstanceSlot(model, instanceIndex);
+    if (slot && slot->stats) {
+        slot->stats->get(rpc).recordAllocations(counts);
+    }
+#endif
+}
+
+// A query waiting for its handler, with its request. Calls are pooled by
+// request type and the requests keep the capacity of their repeated fields,
+// so that steady-state calls are parsed without allocating. A call goes back
+// to its pool when its Handle is dropped.
+template <typename Input>
+struct PendingCall {
+    Model* model = nullptr;
+    size_t rpc = 0;
+    int instanceIndex = -1;
+    Input input;
+    std::optional<zenoh::Query> query;
+    uint64_t received = 0;
+    uint64_t decoded = 0;
+    size_t bytesIn = 0;
+    uint64_t decodeAllocations = 0;
+
+    struct Release {
+        void operator()(PendingCall* call) const {
+            release(call);
+        }
+    };
+    using Handle = std::unique_ptr<PendingCall, Release>;
+
+    static PendingCall* acquire(Model& model, size_t rpc) {
+        PendingCall* call = nullptr;
+        {
+            Pool& free = pool();
+            std::lock_guard<std::mutex> lock(free.mutex);
+            if (!free.calls.empty()) {
+                call = free.calls.back();
+                free.calls.pop_back();
+            }
+        }
+        if (!call) {
+            call = new PendingCall();
+        }
+        call->model = &model;
+        call->rpc = rpc;
+        return call;
+    }
+
+    // Dropping the query sends the final reply.
+    static void release(PendingCall* call) {
+        call->query.reset();
+        clear(call->input);
+        {
+            Pool& free = pool();
+            std::lock_guard<std::mutex> lock(free.mutex);
+            if (free.calls.size() < MAX_POOLED_CALLS) {
+                free.calls.push_back(call);
+                return;
+            }
+        }
+        delete call;
+    }
+
+private:
+    struct Pool {
+        Pool() {
+            calls.reserve(MAX_POOLED_CALLS);
+        }
+        ~Pool() {
+            for (PendingCall* call : calls) {
+                delete call;
+            }
+        }
+        std::mutex mutex;
+        std::vector<PendingCall*> calls;
+    };
+
+    static Pool& pool() {
+        static Pool calls;
+        return calls;
+    }
+
+    static void clear(google::protobuf::Message& message) {
+        message.Clear();
+    }
+
+    static void clear(payload::View& view) {
+        view.clear();
+    }
+};
+
+// Arena of the reply messages built by a thread (a worker, or a Zenoh thread
+// without workers). It is reset for each call.
+thread_local payload::MessageArena replyArena;
+
+// Scratch array of a handler, reused by the next calls on the thread. It grows
+// to the high-water mark and is only valid until the next call.
+template <typename T>
+T* scratchArray(size_t n) {
+    thread_local std::unique_ptr<T[]> buffer;
+    thread_local size_t capacity = 0;
+    if (capacity < n) {
+        buffer.reset(new T[n]);
+        capacity = n;
+    }
+    return buffer.get();
+}
+
+json modelStats(Model& model) {
+    json instanceStats = json::object();
+    {
+        std::lock_guard<std::mutex> lock(model.statsMutex);
+        for (const auto& entry : model.instanceStats) {
+            instanceStats[std::to_string(entry.first)] = entry.second->toJson(model.rpcNames, SERVER_PHASES);
+        }
+    }
+    return {
+        {"responderId", model.responderId},
+        {"functions", model.rpcStats.toJson(model.rpcNames, SERVER_PHASES)},
+        {"instances", instanceStats},
+        {"pool", {
+            {"size", model.poolSize},
+            {"hits", model.poolHits.load()},
+            {"misses", model.poolMisses.load()}
+        }}
+    };
+}
+
+// Instance index of a request, or -1 for messages without one (instantiation).
+template <typename Message>
+auto instanceIndexOf(const Message& message, int) -> decltype(message.instance_index()) {
+    return message.instance_index();
+}
+
+template <typename Message>
+int instanceIndexOf(const Message& message, long) {
+    return -1;
+}
+
+// Marks the reply of a call that threw (e.g. for a stale instance handle) as
+// failed, so that the client gets an error instead of no reply at all.
+template <typename Message>
+auto setErrorStatus(Message& message, int) -> decltype(message.set_status(proto::ERROR)) {
+    message.set_status(proto::ERROR);
+}
+
+template <typename Message>
+void setErrorStatus(Message& message, long) {
+}
+
+void setErrorStatus(proto::fmi3InstanceMessage& message, int) {
+    message.set_instance_index(-1);
+}
 
 
 const fmi3ValueReference* convertRepeatedFieldToCArray(const google::protobuf::RepeatedField<int>& repeatedField) {
@@ -210,16 +746,103 @@ void freeCArray(const fmi3ValueReference* cArray, size_t size) {
     delete[] cArray;
 }
 
+// Tracing every query costs a formatting call per request, so it is only
+// compiled in with LIAISON_TRACE_QUERIES.
+#ifdef LIAISON_TRACE_QUERIES
 void printQuery(const zenoh::Query& query) {
     spdlog::debug("Query: {}", query.get_keyexpr().as_string_view());
 }
+#else
+inline void printQuery(const zenoh::Query&) {
+}
+#endif
+
+// Hedged queries reach every replica of the responder ID, with the ID of the
+// server holding the instance as attachment. The other replicas leave them
+// without a reply, since their instances with the same index are others.
+bool answersQuery(const zenoh::Query& query) {
+    auto attachment = query.get_attachment();
+    if (!attachment.has_value()) {
+        return true;
+    }
+    payload::View view(attachment->get());
+    uint64_t id;
+    if (view.size() != sizeof(id)) {
+        return true;
+    }
+    std::memcpy(&id, view.data(), sizeof(id));
+    return id == serverId;
+}
+
+size_t payloadSize(const zenoh::Query& query) {
+    auto payload = query.get_payload();
+    return payload.has_value() ? payload->get().size() : 0;
+}
+
+// The value references of a Get/Set message. They are sent as int32, which has
+// the layout of fmi3ValueReference.
+template <typename InputMessage>
+const fmi3ValueReference* valueReferencesOf(const InputMessage& input) {
+    return reinterpret_cast<const fmi3ValueReference*>(input.value_references().data());
+}
+
+// Whether a request for nValueReferences variables may carry nValues values,
+// which the client sends and the server allocates: one per variable, or more,
+// up to MAX_ARRAY_VALUES, if the model has array variables.
+bool validValueCount(const Model& model, size_t nValueReferences, size_t nValues) {
+    if (nValues == nValueReferences) {
+        return true;
+    }
+    return model.arrayVariables && nValues > nValueReferences && nValues <= MAX_ARRAY_VALUES;
+}
+
+// The values of a repeated field as an array of T: the field itself when its
+// elements are of type T, otherwise a copy converted into scratch.
+template <typename T, typename Field>
+const T* inPlaceValues(const Field& field) {
+    if constexpr (std::is_same<T, typename Field::value_type>::value) {
+        return field.data();
+    } else {
+        T* converted = scratchArray<T>(field.size());
+        std::copy(field.begin(), field.end(), converted);
+        return converted;
+    }
+}
+
+// Storage for n values of type T to be returned in a repeated field: the field
+// itself when its elements are of type T, otherwise scratch, which the caller
+// then adds to the field. Sets converted accordingly.
+template <typename T, typename Field>
+T* outputValues(Field& field, size_t n, bool& converted) {
+    converted = !std::is_same<T, typename Field::value_type>::value;
+    if constexpr (std::is_same<T, typename Field::value_type>::value) {
+        field.Resize(static_cast<int>(n), T());
+        return field.mutable_data();
+    } else {
+        field.Reserve(static_cast<int>(n));
+        return scratchArray<T>(n);
+    }
+}
 
-fmi3Instance getInstance(int index) {
-    auto it = instances.find(index);
-    if (it == instances.end()) {
+InstanceSlot& getInstanceSlot(const Model& model, int index) {
+    InstanceSlot* slot = findInstanceSlot(model, index);
+    if (!slot) {
         throw std::out_of_range("Instance index out of range.");
     }
-    return it->second;
+    return *slot;
+}
+
+fmi3Instance getInstance(const Model& model, int index) {
+    return getInstanceSlot(model, index).instance;
+}
+
+proto::Encoding negotiateEncoding(const google::protobuf::RepeatedField<int>& encodings) {
+    for (int encoding : encodings) {
+        if (encoding == proto::COMPACT) {
+            return proto::COMPACT;
+        }
+    }
+    return proto::PROTOBUF;
 }
 
 proto::Status transformToProtoStatus(fmi3Status status) {
@@ -239,274 +862,770 @@ proto::Status transformToProtoStatus(fmi3Status status) {
     }
 }
 
-proto::fmi3StatusMessage makeFmi3StatusMessage(fmi3Status status) {
-    proto::fmi3StatusMessage status_message;
-    status_message.set_status(transformToProtoStatus(status));
-    return status_message;
+// Keeps the environment of a new instance, or drops it if the instantiation
+// failed.
+fmi3Instance keepEnvironment(Model& model, fmi3Instance instance, std::unique_ptr<InstanceEnvironment> environment) {
+    if (instance) {
+        std::lock_guard<std::mutex> lock(model.environmentsMutex);
+        model.environments[instance] = std::move(environment);
+    }
+    return instance;
 }
 
-namespace fmu {
-    fmi3SetDebugLoggingTYPE* fmi3SetDebugLogging;
-    fmi3InstantiateCoSimulationTYPE* fmi3InstantiateCoSimulation;
-    fmi3InstantiateModelExchangeTYPE* fmi3InstantiateModelExchange;
-    fmi3InstantiateScheduledExecutionTYPE* fmi3InstantiateScheduledExecution;
-    fmi3EnterEventModeTYPE* fmi3EnterEventMode;
-    fmi3EnterInitializationModeTYPE* fmi3EnterInitializationMode;
-    fmi3ExitInitializationModeTYPE* fmi3ExitInitializationMode;
-    fmi3FreeInstanceTYPE* fmi3FreeInstance;
-    fmi3DoStepTYPE* fmi3DoStep;
-    fmi3SetFloat32TYPE* fmi3SetFloat32;
-    fmi3GetFloat32TYPE* fmi3GetFloat32;
-    fmi3SetFloat64TYPE* fmi3SetFloat64;
-    fmi3GetFloat64TYPE* fmi3GetFloat64;
-    fmi3SetInt8TYPE* fmi3SetInt8;
-    fmi3GetInt8TYPE* fmi3GetInt8;
-    fmi3SetUInt8TYPE* fmi3SetUInt8;
-    fmi3GetUInt8TYPE* fmi3GetUInt8;
-    fmi3SetInt16TYPE* fmi3SetInt16;
-    fmi3GetInt16TYPE* fmi3GetInt16;
-    fmi3SetUInt16TYPE* fmi3SetUInt16;
-    fmi3GetUInt16TYPE* fmi3GetUInt16;
-    fmi3SetInt32TYPE* fmi3SetInt32;
-    fmi3GetInt32TYPE* fmi3GetInt32;
-    fmi3SetUInt32TYPE* fmi3SetUInt32;
-    fmi3GetUInt32TYPE* fmi3GetUInt32;
-    fmi3SetInt64TYPE* fmi3SetInt64;
-    fmi3GetInt64TYPE* fmi3GetInt64;
-    fmi3SetUInt64TYPE* fmi3SetUInt64;
-    fmi3GetUInt64TYPE* fmi3GetUInt64;
-    fmi3SetBooleanTYPE* fmi3SetBoolean;
-    fmi3GetBooleanTYPE* fmi3GetBoolean;
-    fmi3SetStringTYPE* fmi3SetString;
-    fmi3GetStringTYPE* fmi3GetString;
-    fmi3SetClockTYPE* fmi3SetClock;
-    fmi3GetClockTYPE* fmi3GetClock;
-    fmi3SetBinaryTYPE* fmi3SetBinary;
-    fmi3GetBinaryTYPE* fmi3GetBinary;
-    fmi3ResetTYPE* fmi3Reset;
-    fmi3TerminateTYPE* fmi3Terminate;
-} 
+// Routes the log messages of an instance to the client of an index, or to
+// nobody with -1.
+void setEnvironmentIndex(Model& model, fmi3Instance instance, int index) {
+    std::lock_guard<std::mutex> lock(model.environmentsMutex);
+    auto environment = model.environments.find(instance);
+    if (environment != model.environments.end()) {
+        environment->second->index.store(index, std::memory_order_relaxed);
+    }
+}
 
+// Frees an instance and then its environment.
+void freeInstance(Model& model, fmi3Instance instance) {
+    model.fmu.fmi3FreeInstance(instance);
+    std::lock_guard<std::mutex> lock(model.environmentsMutex);
+    model.environments.erase(instance);
+}
 
-namespace callbacks {
+// Returns the index of the new instance, or -1 if the registry is full.
+// The instance can be bound later with bindInstance.
+int addInstance(Model& model, fmi3Instance instance, const std::string& poolKey) {
+    auto instanceStats = std::make_shared<RpcStats>();
+    int index = instances.insert([&model, instance, &poolKey, &instanceStats](InstanceSlot& slot) {
+        slot.model = &model;
+        slot.instance = instance;
+        slot.poolKey = poolKey;
+        slot.stats = instanceStats;
+        if (executor && !slot.strand) {
+            slot.strand = std::make_shared<Strand>(*executor);
+        }
+    });
+    if (index < 0) {
+        spdlog::error("Too many FMU instances.");
+        if (instance) {
+            freeInstance(model, instance);
+        }
+    } else {
+        std::lock_guard<std::mutex> lock(model.statsMutex);
+        model.instanceStats[index] = instanceStats;
+    }
+    return index;
+}
 
-    void fmi3LogMessage(fmi3InstanceEnvironment instanceEnvironment,
-                    fmi3Status status,
-                    fmi3String category,
-                    fmi3String message
-                    ) {
+// Instantiates one instance for a pool on the strand of the model, until the
+// pool is full. Without an executor, pools are only filled by recycling.
+void refillPool(Model& model, const std::string& key) {
+    if (!executor || poolRefillsStopped) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(model.poolMutex);
+        InstancePool& pool = model.pools[key];
+        if (pool.refilling || pool.warm.size() >= model.poolSize) {
+            return;
+        }
+        pool.refilling = true;
+    }
+    model.strand->post([&model, key]() {
+        std::function<fmi3Instance()> instantiate;
+        {
+            std::lock_guard<std::mutex> lock(model.poolMutex);
+            instantiate = model.pools[key].instantiate;
+        }
+        fmi3Instance instance = instantiate();
+        {
+            std::lock_guard<std::mutex> lock(model.poolMutex);
+            InstancePool& pool = model.pools[key];
+            pool.refilling = false;
+            if (!instance) {
+                spdlog::warn("Failed to pre-instantiate an instance of {}.", model.responderId);
+                return;
+            }
+            pool.warm.push_back(instance);
+        }
+        refillPool(model, key);
+    });
+}
 
-        switch (status) {
-            case fmi3OK:
-                spdlog::info("[FMU log] fmi3OK: {} : {}", std::string(category), std::string(message));
-                break;
-            case fmi3Warning:
-                spdlog::warn("[FMU log] fmi3Warning: {} : {}", std::string(category), std::string(message));
-                break;
-            case fmi3Discard:
-                spdlog::warn("[FMU log] fmi3Discard: {} : {}", std::string(category), std::string(message));
-                break;
-            case fmi3Error:
-                spdlog::error("[FMU log] fmi3Error: {} : {}", std::string(category), std::string(message));
+// Takes a warm instance from the pool of the instantiation arguments, or
+// returns nullptr on a miss. Either way, the pool is refilled in the background.
+fmi3Instance takeWarmInstance(Model& model, const std::string& key, std::function<fmi3Instance()> instantiate) {
+    fmi3Instance instance = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(model.poolMutex);
+        InstancePool& pool = model.pools[key];
+        if (!pool.instantiate) {
+            pool.instantiate = std::move(instantiate);
+        }
+        if (!pool.warm.empty()) {
+            instance = pool.warm.back();
+            pool.warm.pop_back();
+        }
+    }
+    if (instance) {
+        model.poolHits++;
+    } else {
+        model.poolMisses++;
+    }
+    refillPool(model, key);
+    return instance;
+}
+
+// Resets a freed instance and returns it to its pool. Returns false if the
+// instance should be freed instead.
+bool recycleInstance(Model& model, const std::string& key, fmi3Instance instance) {
+    if (key.empty() || !instance) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(model.poolMutex);
+        auto pool = model.pools.find(key);
+        if (pool == model.pools.end() || pool->second.warm.size() >= model.poolSize) {
+            return false;
+        }
+    }
+    setEnvironmentIndex(model, instance, -1);
+    if (model.fmu.fmi3Reset(instance) != fmi3OK) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(model.poolMutex);
+    InstancePool& pool = model.pools[key];
+    if (pool.warm.size() >= model.poolSize) {
+        return false;
+    }
+    pool.warm.push_back(instance);
+    return true;
+}
+
+void freePooledInstances(Model& model) {
+    std::lock_guard<std::mutex> lock(model.poolMutex);
+    for (auto& pool : model.pools) {
+        for (fmi3Instance instance : pool.second.warm) {
+            freeInstance(model, instance);
+        }
+        pool.second.warm.clear();
+    }
+}
+
+#ifdef LIAISON_LOCAL_RT
+// Passes the inputs of a type written by the client since the last command to
+// the FMU. The client waits for the command, so the values are stable.
+template <typename T, typename SetFunction>
+fmi3Status applyLocalInputs(LocalRealTime& rt, SetFunction* fmi3Set, fmi3Instance instance, codec::Type type) {
+    localrt::Variable* variables = rt.table->variables();
+    T* values = reinterpret_cast<T*>(rt.values.data());
+    size_t n = 0;
+    for (uint32_t index : rt.inputs[static_cast<size_t>(type)]) {
+        localrt::Variable& variable = variables[index];
+        if (variable.dirty.exchange(0, std::memory_order_relaxed)) {
+            rt.valueReferences[n] = variable.valueReference;
+            values[n++] = localrt::fromBits<T>(variable.value.load(std::memory_order_relaxed));
+        }
+    }
+    return n > 0 ? fmi3Set(instance, rt.valueReferences.data(), n, values, n) : fmi3OK;
+}
+
+// Reads variables of a type from the FMU into the table.
+template <typename T, typename GetFunction>
+fmi3Status readLocalValues(LocalRealTime& rt, GetFunction* fmi3Get, fmi3Instance instance, const std::vector<uint32_t>& indices) {
+    if (indices.empty()) {
+        return fmi3OK;
+    }
+    localrt::Variable* variables = rt.table->variables();
+    T* values = reinterpret_cast<T*>(rt.values.data());
+    for (size_t i = 0; i < indices.size(); ++i) {
+        rt.valueReferences[i] = variables[indices[i]].valueReference;
+    }
+    fmi3Status status = fmi3Get(instance, rt.valueReferences.data(), indices.size(), values, indices.size());
+    if (status <= fmi3Warning) {
+        rt.table->write([&]() {
+            for (size_t i = 0; i < indices.size(); ++i) {
+                variables[indices[i]].value.store(localrt::toBits(values[i]), std::memory_order_relaxed);
+            }
+        });
+    }
+    return status;
+}
+
+fmi3Status applyLocalInputs(Model& model, LocalRealTime& rt, fmi3Instance instance) {
+    fmi3Status status = fmi3OK;
+    FOR_EACH_SCALAR_TYPE(APPLY_LOCAL_INPUTS)
+    return status;
+}
+
+fmi3Status readLocalValues(Model& model, LocalRealTime& rt, fmi3Instance instance, const std::vector<uint32_t> (&indices)[localrt::N_TYPES]) {
+    fmi3Status status = fmi3OK;
+    FOR_EACH_SCALAR_TYPE(READ_LOCAL_VALUES)
+    return status;
+}
+
+// Runs the commands of the client of a local table until the instance is freed.
+void runLocalRealTime(Model& model, LocalRealTime& rt, fmi3Instance instance, int instanceIndex, size_t rpcDoStep) {
+    localrt::Header& header = rt.table->header();
+    uint32_t handled = header.request.load(std::memory_order_acquire);
+    while (true) {
+        uint32_t request = rt.table->nextRequest(handled);
+        if (rt.stopping) {
+            return;
+        }
+        handled = request;
+        uint64_t started = stats::now();
+        fmi3Status status = applyLocalInputs(model, rt, instance);
+        switch (header.command) {
+            case localrt::Command::Sync:
+                status = std::max(status, readLocalValues(model, rt, instance, rt.inputs));
+                status = std::max(status, readLocalValues(model, rt, instance, rt.outputs));
                 break;
-            case fmi3Fatal:
-                spdlog::critical("[FMU log] fmi3Fatal: {} : {}", std::string(category), std::string(message));
+            case localrt::Command::Step:
+                if (status <= fmi3Warning) {
+                    fmi3Boolean eventHandlingNeeded = header.eventHandlingNeeded;
+                    fmi3Boolean terminateSimulation = header.terminateSimulation;
+                    fmi3Boolean earlyReturn = header.earlyReturn;
+                    fmi3Float64 lastSuccessfulTime = header.lastSuccessfulTime;
+                    status = std::max(status, model.fmu.fmi3DoStep(
+                        instance,
+                        header.currentCommunicationPoint,
+                        header.communicationStepSize,
+                        header.noSetFMUStatePriorToCurrentPoint,
+                        &eventHandlingNeeded,
+                        &terminateSimulation,
+                        &earlyReturn,
+                        &lastSuccessfulTime
+                    ));
+                    header.eventHandlingNeeded = eventHandlingNeeded;
+                    header.terminateSimulation = terminateSimulation;
+                    header.earlyReturn = earlyReturn;
+                    header.lastSuccessfulTime = lastSuccessfulTime;
+                }
+                if (status <= fmi3Warning) {
+                    status = std::max(status, readLocalValues(model, rt, instance, rt.outputs));
+                }
+                recordCall(model, rpcDoStep, instanceIndex, {0, 0, stats::now() - started, 0}, 0, 0);
                 break;
             default:
-                spdlog::error("[FMU log] Unknown status: {} : {}", std::string(category), std::string(message));
                 break;
-        };
+        }
+        header.status = transformToProtoStatus(status);
+        rt.table->complete(request);
+    }
+}
 
-        // Publish log message to zenoh
-        proto::logMessage log_message;
-        log_message.set_status(transformToProtoStatus(status));
-        log_message.set_category(category);
-        log_message.set_message(message);
-        std::vector<uint8_t> output_wire(log_message.ByteSizeLong()); 
-        log_message.SerializeToArray(output_wire.data(), output_wire.size()); 
-        fmi3LogMessagePublisher->put(zenoh::Bytes(std::move(output_wire)));
+// Creates the local table of an instance and starts its thread. Returns the
+// name of the table, or an empty string if the mode is not available.
+std::string startLocalRealTime(Model& model, int instanceIndex) {
+    InstanceSlot* slot = findInstanceSlot(model, instanceIndex);
+    if (!slot || !slot->instance) {
+        return "";
+    }
+    if (!model.parallelInstances) {
+        spdlog::warn("{} can only be instantiated once per process, the local real-time mode is not available.", model.fmuPath);
+        return "";
+    }
+    static std::atomic<uint32_t> tables{0};
+    std::string name = fmt::format("/liaison-{}-{}", getpid(), tables++);
+    auto rt = std::make_unique<LocalRealTime>();
+    try {
+        rt->table = localrt::Table::create(name, model.localVariables);
+    } catch (const std::exception& e) {
+        spdlog::warn("{}", e.what());
+        return "";
+    }
+    localrt::Variable* variables = rt->table->variables();
+    for (uint32_t i = 0; i < rt->table->count(); ++i) {
+        auto& indices = variables[i].causality == localrt::INPUT ? rt->inputs : rt->outputs;
+        indices[static_cast<size_t>(variables[i].type)].push_back(i);
     }
+    rt->valueReferences.resize(rt->table->count());
+    rt->values.resize(rt->table->count());
+
+    size_t rpcDoStep = std::find(model.rpcNames.begin(), model.rpcNames.end(), "fmi3DoStep") - model.rpcNames.begin();
+    rt->thread = std::thread(runLocalRealTime, std::ref(model), std::ref(*rt), slot->instance, instanceIndex, rpcDoStep);
+    slot->localRealTime = std::move(rt);
+    spdlog::debug("Instance {} of {} uses the local table {}.", instanceIndex, model.responderId, name);
+    return name;
+}
+#endif
 
-    void fmi3SetDebugLogging(const zenoh::Query& query) {
-        printQuery(query);
 
-        proto::fmi3SetDebugLoggingMessage input;
-        PARSE_QUERY(query, input)
+// Declares the publisher of the pushed outputs of an instance. Returns its
+// key, or an empty string if the model has no scalar outputs.
+std::string startPushedOutputs(Model& model, int instanceIndex) {
+    InstanceSlot* slot = findInstanceSlot(model, instanceIndex);
+    if (!slot || !slot->instance) {
+        return "";
+    }
+    auto pushed = std::make_unique<PushedOutputs>();
+    size_t largest = 0;
+    for (size_t type = 0; type < codec::N_TYPES; ++type) {
+        const std::vector<fmi3ValueReference>& valueReferences = model.outputs[type];
+        if (valueReferences.empty()) {
+            continue;
+        }
+        proto::fmi3PushedValuesMessage& values = *pushed->message.add_values();
+        values.set_type(static_cast<uint32_t>(type));
+        values.mutable_value_references()->Add(valueReferences.begin(), valueReferences.end());
+        largest = std::max(largest, valueReferences.size());
+    }
+    if (largest == 0) {
+        return "";
+    }
+    pushed->buffer.resize(largest);
+    std::string key = "rpc/" + model.responderId + "/push/" + std::to_string(instanceIndex);
+    pushed->publisher = std::make_unique<zenoh::Publisher>(session->declare_publisher(zenoh::KeyExpr(key)));
+    slot->pushedOutputs = std::move(pushed);
+    return key;
+}
 
+template <typename T, typename GetFunction>
+fmi3Status readPushedValues(GetFunction* fmi3Get, fmi3Instance instance, proto::fmi3PushedValuesMessage& message, std::vector<uint64_t>& buffer) {
+    size_t n = message.value_references_size();
+    T* values = reinterpret_cast<T*>(buffer.data());
+    fmi3Status status = fmi3Get(instance, message.value_references().data(), n, values, n);
+    std::string& bytes = *message.mutable_values();
+    bytes.resize(codec::valuesSize<T>(n));
+    codec::writeValues(codec::bufferData(bytes), values, n);
+    return status;
+}
+
+// Publishes the outputs of an instance after a successful step, before the
+// reply. Returns the sequence number of the step, or 0 if nothing was published.
+uint64_t publishOutputs(Model& model, InstanceSlot& slot) {
+    PushedOutputs& pushed = *slot.pushedOutputs;
+    fmi3Status status = fmi3OK;
+    for (auto& values : *pushed.message.mutable_values()) {
+        switch (static_cast<codec::Type>(values.type())) {
+            FOR_EACH_SCALAR_TYPE(PUSH_OUTPUTS_CASE)
+        }
+    }
+    if (status > fmi3Warning) {
+        return 0;
+    }
+    pushed.message.set_sequence(pushed.message.sequence() + 1);
+    pushed.publisher->put(payload::serialize(pushed.message, sharedMemory.get()));
+    return pushed.message.sequence();
+}
+
+
+void printLogMessage(fmi3Status status, const std::string& category, const std::string& message) {
+    switch (status) {
+        case fmi3OK:
+            spdlog::info("[FMU log] fmi3OK: {} : {}", category, message);
+            break;
+        case fmi3Warning:
+            spdlog::warn("[FMU log] fmi3Warning: {} : {}", category, message);
+            break;
+        case fmi3Discard:
+            spdlog::warn("[FMU log] fmi3Discard: {} : {}", category, message);
+            break;
+        case fmi3Error:
+            spdlog::error("[FMU log] fmi3Error: {} : {}", category, message);
+            break;
+        case fmi3Fatal:
+            spdlog::critical("[FMU log] fmi3Fatal: {} : {}", category, message);
+            break;
+        default:
+            spdlog::error("[FMU log] Unknown status: {} : {}", category, message);
+            break;
+    };
+}
+
+struct LogEntry {
+    Model* model = nullptr;
+    int index = -1;
+    fmi3Status status = fmi3OK;
+    std::string category;
+    std::string message;
+};
+
+// FMU log messages. The callback only queues a message; a background thread
+// prints the queued messages, rate limits them per model and category, and
+// publishes them in one batch per instance every LOG_FLUSH_INTERVAL, on
+// rpc/<responderId>/fmi3LogMessage/<instanceIndex>. Batches are not serialized
+// when no client subscribes, and messages of instances without a client are
+// only printed. Errors are never rate limited.
+class LogPipeline {
+public:
+    explicit LogPipeline(double rate)
+        : queue(LOG_QUEUE_CAPACITY)
+        , rate(rate) {
+        thread = std::thread([this]() { run(); });
+    }
+
+    ~LogPipeline() {
+        stop();
+    }
+
+    // Returns false once stopped, leaving the message to the caller.
+    bool push(Model* model, int index, fmi3Status status, fmi3String category, fmi3String message) {
+        if (!running.load(std::memory_order_acquire)) {
+            return false;
+        }
+        LogEntry entry{model, index, status, category ? category : "", message ? message : ""};
+        if (!queue.push(std::move(entry))) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // Publishes the queued messages and stops the thread.
+    void stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        thread.join();
+        publishers.clear();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wakeUp.wait_for(lock, LOG_FLUSH_INTERVAL, [this]() { return stopping; })) {
+            lock.unlock();
+            flush();
+            lock.lock();
+        }
+        lock.unlock();
+        flush();
+    }
+
+    void flush() {
+        uint64_t now = stats::now();
+        LogEntry entry;
+        while (queue.pop(entry)) {
+            if (entry.status < fmi3Error && !limiter(entry.model, entry.category).allow(now)) {
+                continue;
+            }
+            printLogMessage(entry.status, entry.category, entry.message);
+            if (entry.index >= 0) {
+                add({entry.model, entry.index}, entry.status, std::move(entry.category), std::move(entry.message));
+            }
+        }
+
+        // Report what was left out, at most once per second
+        if (now - lastReport >= 1000000000) {
+            lastReport = now;
+            for (auto& limited : limiters) {
+                uint64_t suppressed = limited.second.takeSuppressed();
+                if (suppressed > 0) {
+                    printLogMessage(fmi3Warning, "Liaison", fmt::format("Suppressed {} log messages of {} of category {}",
+                        suppressed, limited.first.first->responderId, limited.first.second));
+                }
+            }
+            uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+            if (lost > 0) {
+                spdlog::warn("Dropped {} FMU log messages, the log queue was full", lost);
+            }
+        }
+
+        for (auto it = publishers.begin(); it != publishers.end();) {
+            InstancePublisher& instance = it->second;
+            if (instance.batch.messages_size() > 0) {
+                instance.lastUsed = now;
+                publish(it->first, instance);
+                instance.batch.Clear();
+                ++it;
+            } else if (now - instance.lastUsed > LOG_PUBLISHER_IDLE_TIME) {
+                it = publishers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    using InstanceKey = std::pair<Model*, int>;
+
+    // Publisher of the messages of an instance, declared with its first batch
+    // and dropped once idle.
+    struct InstancePublisher {
+        std::unique_ptr<zenoh::Publisher> publisher;
+        proto::logMessageBatch batch;
+        uint64_t lastUsed = 0;
+    };
+
+    void publish(const InstanceKey& key, InstancePublisher& instance) {
+        Model* model = key.first;
+        try {
+            if (!instance.publisher) {
+                std::string expr = "rpc/" + model->responderId + "/fmi3LogMessage/" + std::to_string(key.second);
+                instance.publisher = std::make_unique<zenoh::Publisher>(session->declare_publisher(zenoh::KeyExpr(expr)));
+            }
+            if (instance.publisher->get_matching_status().matching) {
+                instance.publisher->put(payload::serialize(instance.batch));
+            }
+        } catch (const zenoh::ZException& e) {
+            spdlog::error("Failed to publish the log messages of {}: {}", model->responderId, e.what());
+        }
+    }
+
+    void add(const InstanceKey& key, fmi3Status status, std::string&& category, std::string&& message) {
+        proto::logMessage* log_message = publishers[key].batch.add_messages();
+        log_message->set_status(transformToProtoStatus(status));
+        log_message->set_category(std::move(category));
+        log_message->set_message(std::move(message));
+    }
+
+    RateLimiter& limiter(Model* model, const std::string& category) {
+        auto key = std::make_pair(model, category);
+        auto it = limiters.find(key);
+        if (it == limiters.end()) {
+            it = limiters.emplace(std::move(key), RateLimiter(rate)).first;
+        }
+        return it->second;
+    }
+
+    BoundedQueue<LogEntry> queue;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> running{true};
+    double rate;
+
+    // Owned by the thread
+    std::map<std::pair<Model*, std::string>, RateLimiter> limiters;
+    std::map<InstanceKey, InstancePublisher> publishers;
+    uint64_t lastReport = 0;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+    std::thread thread;
+};
+
+// Log pipeline of the server. Without it, log messages are only printed.
+std::unique_ptr<LogPipeline> logPipeline;
+
+
+namespace callbacks {
+
+    void fmi3LogMessage(fmi3InstanceEnvironment instanceEnvironment,
+                    fmi3Status status,
+                    fmi3String category,
+                    fmi3String message
+                    ) {
+        InstanceEnvironment* environment = static_cast<InstanceEnvironment*>(instanceEnvironment);
+        int index = environment->index.load(std::memory_order_relaxed);
+        if (!logPipeline || !logPipeline->push(environment->model, index, status, category, message)) {
+            printLogMessage(status, category ? category : "", message ? message : "");
+        }
+    }
+
+}
+
+
+namespace handlers {
+
+    void fmi3SetDebugLogging(Model& model, const proto::fmi3SetDebugLoggingMessage& input, proto::fmi3StatusMessage& output) {
         const char** categories = convertRepeatedFieldToCArray(input.categories());
 
-        fmi3Status status = fmu::fmi3SetDebugLogging(
-            getInstance(input.instance_index()),
+        fmi3Status status = model.fmu.fmi3SetDebugLogging(
+            getInstance(model, input.instance_index()),
             input.logging_on(),
             input.n_categories(),
             categories
         );
 
         freeCArray(categories, input.n_categories());
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        output.set_status(transformToProtoStatus(status));
     }
 
-    void fmi3InstantiateCoSimulation(const zenoh::Query& query) {
-        printQuery(query);
-
-        proto::fmi3InstantiateCoSimulationMessage input;
-        PARSE_QUERY(query, input)
-
+    // The instance environment routes the log messages of the instance to the
+    // client of the index, if any.
+    fmi3Instance instantiate(Model& model, const proto::fmi3InstantiateCoSimulationMessage& input, int index) {
         const fmi3ValueReference* required_intermediate_variables = convertRepeatedFieldToCArray(input.required_intermediate_variables());
+        auto environment = std::make_unique<InstanceEnvironment>();
+        environment->model = &model;
+        environment->index = index;
 
-        fmi3Instance instance = fmu::fmi3InstantiateCoSimulation(
+        fmi3Instance instance = model.fmu.fmi3InstantiateCoSimulation(
             input.instance_name().c_str(),
             input.instantiation_token().c_str(),
-            *resourcePath,
+            model.resourcePath.c_str(),
             input.visible(),
             input.logging_on(),
             input.event_mode_used(),
             input.early_return_allowed(),
             required_intermediate_variables,
             input.n_required_intermediate_variables(),
-            nullptr,
-            fmi3LogMessage,
+            environment.get(),
+            callbacks::fmi3LogMessage,
             nullptr
         );
 
         freeCArray(required_intermediate_variables, input.n_required_intermediate_variables());
-
-        proto::fmi3InstanceMessage output;
-        instances[nextIndex] = instance;
-        output.set_instance_index(nextIndex);
-        SERIALIZE_REPLY(query, output)
-        nextIndex++;
+        return keepEnvironment(model, instance, std::move(environment));
     }
 
-    void fmi3InstantiateModelExchange(const zenoh::Query& query) {
-        printQuery(query);
-
-        proto::fmi3InstantiateModelExchangeMessage input;
-        PARSE_QUERY(query, input)
-
-        fmi3Instance instance = fmu::fmi3InstantiateModelExchange(
+    fmi3Instance instantiate(Model& model, const proto::fmi3InstantiateModelExchangeMessage& input, int index) {
+        auto environment = std::make_unique<InstanceEnvironment>();
+        environment->model = &model;
+        environment->index = index;
+        fmi3Instance instance = model.fmu.fmi3InstantiateModelExchange(
             input.instance_name().c_str(),
             input.instantiation_token().c_str(),
-            *resourcePath,
+            model.resourcePath.c_str(),
             input.visible(),
             input.logging_on(),
-            nullptr,
-            fmi3LogMessage
+            environment.get(),
+            callbacks::fmi3LogMessage
         );
-
-        proto::fmi3InstanceMessage output;
-        instances[nextIndex] = instance;
-        
-        output.set_instance_index(nextIndex);
-        SERIALIZE_REPLY(query, output)
-        nextIndex++;
+        return keepEnvironment(model, instance, std::move(environment));
     }
-    
-    void fmi3InstantiateScheduledExecution(const zenoh::Query& query) {
-        printQuery(query);
-        proto::fmi3InstantiateScheduledExecutionMessage input;
-        PARSE_QUERY(query, input)
-        fmi3Instance instance = fmu::fmi3InstantiateScheduledExecution(
+
+    fmi3Instance instantiate(Model& model, const proto::fmi3InstantiateScheduledExecutionMessage& input, int index) {
+        auto environment = std::make_unique<InstanceEnvironment>();
+        environment->model = &model;
+        environment->index = index;
+        fmi3Instance instance = model.fmu.fmi3InstantiateScheduledExecution(
             input.instance_name().c_str(),
             input.instantiation_token().c_str(),
-            *resourcePath,
+            model.resourcePath.c_str(),
             input.visible(),
             input.logging_on(),
-            nullptr,
-            fmi3LogMessage,
+            environment.get(),
+            callbacks::fmi3LogMessage,
             nullptr,
             nullptr,
             nullptr
         );
+        return keepEnvironment(model, instance, std::move(environment));
+    }
 
-        proto::fmi3InstanceMessage output;
-        instances[nextIndex] = instance;
-        
-        output.set_instance_index(nextIndex);
-        SERIALIZE_REPLY(query, output)
-        nextIndex++;
+    // Instances are pooled by interface type, instantiation token and the
+    // other arguments fixed at instantiation. The instance name and the
+    // encodings do not change the instance.
+    template <typename Message>
+    std::string poolKey(const Message& input) {
+        Message key = input;
+        key.clear_instance_name();
+        key.clear_encodings();
+        return key.GetTypeName() + "/" + key.SerializeAsString();
     }
 
-    void fmi3EnterEventMode(const zenoh::Query& query) {
-        printQuery(query);
-        
-        proto::fmi3InstanceMessage input;
-        PARSE_QUERY(query, input)
+    // Returns the index of a warm instance from the pool if there is one, or
+    // of a new instance. The index is reserved first, so that the messages
+    // logged during the instantiation reach the client.
+    template <typename Message>
+    int acquireInstance(Model& model, const Message& input) {
+        std::string key = model.poolSize > 0 ? poolKey(input) : "";
+        int index = addInstance(model, nullptr, key);
+        if (index < 0) {
+            return index;
+        }
+        fmi3Instance instance = nullptr;
+        if (!key.empty()) {
+            instance = takeWarmInstance(model, key, [&model, input]() { return instantiate(model, input, -1); });
+            if (instance) {
+                setEnvironmentIndex(model, instance, index);
+            }
+        }
+        if (!instance) {
+            instance = instantiate(model, input, index);
+        }
+        getInstanceSlot(model, index).instance = instance;
+        return index;
+    }
 
-        fmi3Status status = fmu::fmi3EnterEventMode(getInstance(input.instance_index()));
+    void fmi3InstantiateCoSimulation(Model& model, const proto::fmi3InstantiateCoSimulationMessage& input, proto::fmi3InstanceMessage& output) {
+        output.set_instance_index(acquireInstance(model, input));
+        output.set_encoding(negotiateEncoding(input.encodings()));
+        output.set_deterministic(model.deterministic);
+        output.set_server_id(serverId);
+#ifdef LIAISON_LOCAL_RT
+        if (input.local_real_time() && output.instance_index() >= 0) {
+            output.set_local_table(startLocalRealTime(model, output.instance_index()));
+        }
+#endif
+        if (input.push_outputs() && output.instance_index() >= 0) {
+            output.set_push_key(startPushedOutputs(model, output.instance_index()));
+        }
+    }
 
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+    void fmi3InstantiateModelExchange(Model& model, const proto::fmi3InstantiateModelExchangeMessage& input, proto::fmi3InstanceMessage& output) {
+        output.set_instance_index(acquireInstance(model, input));
+        output.set_encoding(negotiateEncoding(input.encodings()));
+        output.set_deterministic(model.deterministic);
+        output.set_server_id(serverId);
     }
 
+    void fmi3InstantiateScheduledExecution(Model& model, const proto::fmi3InstantiateScheduledExecutionMessage& input, proto::fmi3InstanceMessage& output) {
+        output.set_instance_index(acquireInstance(model, input));
+        output.set_encoding(negotiateEncoding(input.encodings()));
+        output.set_deterministic(model.deterministic);
+        output.set_server_id(serverId);
+    }
 
-    void fmi3EnterInitializationMode(const zenoh::Query& query) {
-        printQuery(query);
-        
-        proto::fmi3EnterInitializationModeMessage input;
-        PARSE_QUERY(query, input)
+    void fmi3EnterEventMode(Model& model, const proto::fmi3InstanceMessage& input, proto::fmi3StatusMessage& output) {
+        fmi3Status status = model.fmu.fmi3EnterEventMode(getInstance(model, input.instance_index()));
+        output.set_status(transformToProtoStatus(status));
+    }
 
-        fmi3Status status = fmu::fmi3EnterInitializationMode(
-            getInstance(input.instance_index()),
+    void fmi3EnterInitializationMode(Model& model, const proto::fmi3EnterInitializationModeMessage& input, proto::fmi3StatusMessage& output) {
+        fmi3Status status = model.fmu.fmi3EnterInitializationMode(
+            getInstance(model, input.instance_index()),
             input.tolerance_defined(),
             input.tolerance(),
             input.start_time(),
             input.stop_time_defined(),
             input.stop_time()
         );
-
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        output.set_status(transformToProtoStatus(status));
     }
 
-    void fmi3ExitInitializationMode(const zenoh::Query& query) {
-        printQuery(query);
-        
-        proto::fmi3InstanceMessage input;
-        PARSE_QUERY(query, input)
-
-        fmi3Status status = fmu::fmi3ExitInitializationMode(getInstance(input.instance_index()));
-
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+    void fmi3ExitInitializationMode(Model& model, const proto::fmi3InstanceMessage& input, proto::fmi3StatusMessage& output) {
+        fmi3Status status = model.fmu.fmi3ExitInitializationMode(getInstance(model, input.instance_index()));
+        output.set_status(transformToProtoStatus(status));
     }
 
-    void fmi3FreeInstance(const zenoh::Query& query) {
-        printQuery(query);
-        
-        proto::fmi3InstanceMessage input;
-        PARSE_QUERY(query, input)
-
-        try {
-            fmu::fmi3FreeInstance(getInstance(input.instance_index()));
-        } catch (std::runtime_error& error) {
-            spdlog::error("Failed to free FMU instance.");
+    void fmi3FreeInstance(Model& model, const proto::fmi3InstanceMessage& input, proto::voidMessage& output) {
+        InstanceSlot* slot = findInstanceSlot(model, input.instance_index());
+        if (slot) {
+            slot->localRealTime.reset();
+            slot->pushedOutputs.reset();
+            // A pooled instance is reset and kept warm instead of being freed
+            if (!recycleInstance(model, slot->poolKey, slot->instance)) {
+                freeInstance(model, slot->instance);
+            }
+            slot->instance = nullptr;
+            slot->poolKey.clear();
+            slot->valueReferenceSets.clear();
+            slot->stats.reset();
+            std::lock_guard<std::mutex> lock(model.statsMutex);
+            model.instanceStats.erase(input.instance_index());
         }
-        try {
-            auto it = instances.find(input.instance_index());
-            instances.erase(it); 
-        } catch (std::runtime_error& error) {
+        if (!slot || !instances.remove(input.instance_index())) {
             spdlog::error("Failed to erase instance from instances.");
         }
-
-        proto::voidMessage output;
-        SERIALIZE_REPLY(query, output)
-
     }
 
-    void fmi3DoStep(const zenoh::Query& query) {
-        printQuery(query);
+    void fmi3RegisterValueReferences(Model& model, const proto::fmi3RegisterValueReferencesMessage& input, proto::fmi3ValueReferencesHandleMessage& output) {
+        std::vector<ValueReferenceSet>& sets = getInstanceSlot(model, input.instance_index()).valueReferenceSets;
+        if (sets.size() >= MAX_VALUE_REFERENCE_SETS) {
+            spdlog::warn("Too many value reference sets registered for instance {}.", input.instance_index());
+            output.set_status(proto::ERROR);
+            return;
+        }
+
+        ValueReferenceSet set;
+        set.valueReferences.assign(input.value_references().begin(), input.value_references().end());
+        set.values.resize(set.valueReferences.size());
+        sets.push_back(std::move(set));
 
-        proto::fmi3DoStepMessage input;
-        PARSE_QUERY(query, input)
+        output.set_handle(sets.size() - 1);
+        output.set_status(proto::OK);
+    }
 
+    void fmi3DoStep(Model& model, const proto::fmi3DoStepMessage& input, proto::fmi3DoStepOutputMessage& output) {
         fmi3Boolean event_handling_needed = input.event_handling_needed();
         fmi3Boolean terminate_simulation = input.terminate_simulation();
         fmi3Boolean early_return = input.early_return();
         fmi3Float64 last_successful_time = input.last_successful_time();
-        fmi3Status status = fmu::fmi3DoStep(
-            getInstance(input.instance_index()),
+        fmi3Status status = model.fmu.fmi3DoStep(
+            getInstance(model, input.instance_index()),
             input.current_communication_point(),
             input.communication_step_size(),
             input.no_set_fmu_state_prior_to_current_point(),
@@ -516,8 +1635,16 @@ namespace callbacks {
             &last_successful_time
         );
 
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        output.set_status(transformToProtoStatus(status));
+        output.set_event_handling_needed(event_handling_needed);
+        output.set_terminate_simulation(terminate_simulation);
+        output.set_early_return(early_return);
+        output.set_last_successful_time(last_successful_time);
+
+        InstanceSlot* slot = findInstanceSlot(model, input.instance_index());
+        if (slot && slot->pushedOutputs && output.status() <= proto::WARNING) {
+            output.set_step_sequence(publishOutputs(model, *slot));
+        }
     }
 
     DEFINE_FMI3_GET_VALUE_FUNCTION(Float32)
@@ -553,189 +1680,481 @@ namespace callbacks {
     DEFINE_FMI3_GET_VALUE_FUNCTION(Boolean)
     DEFINE_FMI3_SET_VALUE_FUNCTION(Boolean)
 
-    void fmi3SetString(const zenoh::Query& query) {
-        printQuery(query);
-
-        proto::fmi3SetStringInputMessage input;
-        
-        PARSE_QUERY(query, input)
-
-        std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]);    
-        for (int i = 0; i < input.n_value_references(); i++) {
-            value_references[i] = input.value_references()[i];
+    // The values are passed as pointers into the request, without a copy.
+    void fmi3SetString(Model& model, const proto::fmi3SetStringInputMessage& input, proto::fmi3StatusMessage& output) {
+        if (input.value_references_size() < input.n_value_references() || input.n_values() < 0 || input.values_size() < input.n_values()) {
+            output.set_status(proto::ERROR);
+            return;
         }
-        std::unique_ptr<fmi3String[]> values(new fmi3String[input.n_value_references()]);
-        for (int i = 0; i < input.n_value_references(); i++) {
-            values[i] = input.values()[i].c_str();
+        size_t nValues = input.n_values();
+        fmi3String* values = scratchArray<fmi3String>(nValues);
+        for (size_t i = 0; i < nValues; ++i) {
+            values[i] = input.values(static_cast<int>(i)).c_str();
         }
 
-        fmi3Status status = fmu::fmi3SetString(
-            getInstance(input.instance_index()),
-            value_references.get(),
+        fmi3Status status = model.fmu.fmi3SetString(
+            getInstance(model, input.instance_index()),
+            valueReferencesOf(input),
             input.n_value_references(),
-            values.get(),
-            input.n_values()
+            values,
+            nValues
         );
         
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        output.set_status(transformToProtoStatus(status));
     }
     DEFINE_FMI3_GET_VALUE_FUNCTION(String)
 
-    void fmi3SetClock(const zenoh::Query& query) {
-        printQuery(query);
-
-        proto::fmi3SetClockInputMessage input;
-        
-        PARSE_QUERY(query, input)
-        std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]);    
-        std::unique_ptr<fmi3Clock[]> values(new fmi3Clock[input.n_value_references()]);
-        for (int i = 0; i < input.n_value_references(); i++) {
-            value_references[i] = input.value_references()[i];
-            values[i] = input.values()[i];
+    void fmi3SetClock(Model& model, const proto::fmi3SetClockInputMessage& input, proto::fmi3StatusMessage& output) {
+        if (input.value_references_size() < input.n_value_references() || input.values_size() < input.n_value_references()) {
+            output.set_status(proto::ERROR);
+            return;
         }
-        
-        fmi3Status status = fmu::fmi3SetClock(
-            getInstance(input.instance_index()),
-            value_references.get(),
+        const fmi3Clock* values = inPlaceValues<fmi3Clock>(input.values());
+
+        fmi3Status status = model.fmu.fmi3SetClock(
+            getInstance(model, input.instance_index()),
+            valueReferencesOf(input),
             input.n_value_references(),
-            values.get()        
+            values
         );
         
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        output.set_status(transformToProtoStatus(status));
     }
 
-    void fmi3GetClock(const zenoh::Query& query) {
-        printQuery(query);
-
-        proto::fmi3GetClockInputMessage input;
-        PARSE_QUERY(query, input)
-
-        std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]);
-        for (int i = 0; i < input.n_value_references(); i++) {
-            value_references[i] = input.value_references()[i];
+    void fmi3GetClock(Model& model, const proto::fmi3GetClockInputMessage& input, proto::fmi3GetClockOutputMessage& output) {
+        if (input.value_references_size() < input.n_value_references()) {
+            output.set_status(proto::ERROR);
+            return;
         }
-        std::unique_ptr<fmi3Clock[]> values(new fmi3Clock[input.n_value_references()]);
-        size_t nValues = input.n_value_references();
+        bool converted;
+        fmi3Clock* values = outputValues<fmi3Clock>(*output.mutable_values(), input.n_value_references(), converted);
 
-        fmi3Status status = fmu::fmi3GetClock(
-            getInstance(input.instance_index()),
-            value_references.get(),
+        fmi3Status status = model.fmu.fmi3GetClock(
+            getInstance(model, input.instance_index()),
+            valueReferencesOf(input),
             input.n_value_references(),
-            values.get()
+            values
         );
 
-        proto::fmi3GetClockOutputMessage output;
-        for (int i = 0; i < input.n_value_references(); i++) {
+        for (int i = 0; converted && i < input.n_value_references(); i++) {
             output.add_values(values[i]);
         }
         output.set_status(transformToProtoStatus(status));
+    }
+
+    // Binary values are passed as pointers into the request, without a copy.
+    void fmi3SetBinary(Model& model, const proto::fmi3SetBinaryInputMessage& input, proto::fmi3StatusMessage& output) {
+        size_t nValues = input.values_size();
+        if (input.value_references_size() < input.n_value_references()) {
+            output.set_status(proto::ERROR);
+            return;
+        }
+        size_t* value_sizes = scratchArray<size_t>(nValues);
+        fmi3Binary* values = scratchArray<fmi3Binary>(nValues);
+        for (size_t i = 0; i < nValues; ++i) {
+            const std::string& value = input.values(static_cast<int>(i));
+            value_sizes[i] = value.size();
+            values[i] = reinterpret_cast<fmi3Binary>(value.data());
+        }
 
-        SERIALIZE_REPLY(query, output)
+        fmi3Status status = model.fmu.fmi3SetBinary(
+            getInstance(model, input.instance_index()),
+            valueReferencesOf(input),
+            input.n_value_references(),
+            value_sizes,
+            values,
+            nValues
+        );
+        
+        output.set_status(transformToProtoStatus(status));
+    }
 
+    // The FMU returns pointers to its own buffers, which are copied once into
+    // the reply, whatever their size.
+    void fmi3GetBinary(Model& model, const proto::fmi3GetBinaryInputMessage& input, proto::fmi3GetBinaryOutputMessage& output) {
+        size_t nValueReferences = input.n_value_references();
+        if (input.value_references_size() < input.n_value_references()) {
+            output.set_status(proto::ERROR);
+            return;
+        }
+        size_t nValues = input.n_values() > 0 ? input.n_values() : nValueReferences;
+        if (!validValueCount(model, nValueReferences, nValues)) {
+            output.set_status(proto::ERROR);
+            return;
+        }
+        // Entries the FMU leaves unset are empty, not left over from an earlier call
+        size_t* value_sizes = scratchArray<size_t>(nValues);
+        fmi3Binary* values = scratchArray<fmi3Binary>(nValues);
+        std::fill(value_sizes, value_sizes + nValues, 0);
+        std::fill(values, values + nValues, nullptr);
+
+        fmi3Status status = model.fmu.fmi3GetBinary(
+            getInstance(model, input.instance_index()),
+            valueReferencesOf(input),
+            nValueReferences,
+            value_sizes,
+            values,
+            nValues
+        );
 
+        if (status < fmi3Error) {
+            output.mutable_values()->Reserve(static_cast<int>(nValues));
+            for (size_t i = 0; i < nValues; ++i) {
+                if (values[i]) {
+                    output.add_values(values[i], value_sizes[i]);
+                } else {
+                    output.add_values();
+                }
+            }
+            output.set_n_values(static_cast<int>(nValues));
+        }
+        output.set_status(transformToProtoStatus(status));
     }
 
+    void fmi3Reset(Model& model, const proto::fmi3InstanceMessage& input, proto::fmi3StatusMessage& output) {
+        fmi3Status status = model.fmu.fmi3Reset(getInstance(model, input.instance_index()));
+        output.set_status(transformToProtoStatus(status));
+    }
 
+    void fmi3Terminate(Model& model, const proto::fmi3InstanceMessage& input, proto::fmi3StatusMessage& output) {
+        fmi3Status status = model.fmu.fmi3Terminate(getInstance(model, input.instance_index()));
+        output.set_status(transformToProtoStatus(status));
+    }
 
-    void fmi3SetBinary(const zenoh::Query& query) {
-        printQuery(query);
+    // Returns the value references of a compact request: the registered set for
+    // its handle, or the inline ones copied into scratch. offset is set to the
+    // start of the values. Returns nullptr if the request is malformed.
+    ValueReferenceSet* resolveValueReferences(Model& model, const codec::Header& header, const uint8_t* input, size_t size, ValueReferenceSet& scratch, size_t& offset) {
+        if (header.flags & codec::FLAG_HANDLE) {
+            InstanceSlot* slot = findInstanceSlot(model, header.instance_index);
+            if (!slot || header.n_value_references >= slot->valueReferenceSets.size()) {
+                return nullptr;
+            }
+            offset = codec::HEADER_SIZE;
+            return &slot->valueReferenceSets[header.n_value_references];
+        }
 
-        proto::fmi3SetBinaryInputMessage input;
-        
-        PARSE_QUERY(query, input)
+        size_t nValueReferences = header.n_value_references;
+        offset = codec::HEADER_SIZE + codec::valueReferencesSize(nValueReferences);
+        if (size < offset) {
+            return nullptr;
+        }
+        scratch.valueReferences.resize(nValueReferences);
+        codec::copyFromLittleEndian(scratch.valueReferences.data(), input + codec::HEADER_SIZE, nValueReferences);
+        return &scratch;
+    }
 
-        size_t nValueReferences = input.n_value_references();
-        std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[nValueReferences]);
-        std::unique_ptr<size_t[]> value_sizes(new size_t[nValueReferences]);
-        std::vector<uint8_t> values;
+    template <typename T>
+    T* valueBuffer(ValueReferenceSet& set, size_t nValues) {
+        size_t words = (nValues * sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        if (set.values.size() < words) {
+            set.values.resize(words);
+        }
+        return reinterpret_cast<T*>(set.values.data());
+    }
 
-        size_t offset = 0;
-        for (size_t i = 0; i < nValueReferences; ++i) {
-            value_references[i] = input.value_references()[i];
-            const std::string& binaryValue = input.values(i);
-            value_sizes[i] = binaryValue.size();
-            values.insert(values.end(), binaryValue.begin(), binaryValue.end());
+    template <typename T, typename GetFunction>
+    void getCompactValues(Model& model, GetFunction* fmi3Get, const codec::Header& header, const uint8_t* input, size_t size, std::string& output) {
+        thread_local ValueReferenceSet scratch;
+        size_t offset;
+        ValueReferenceSet* set = resolveValueReferences(model, header, input, size, scratch, offset);
+        size_t nValues = header.n_values;
+        if (!set || !validValueCount(model, set->valueReferences.size(), nValues)) {
+            codec::encodeStatusReply(output, header.type, proto::ERROR);
+            return;
+        }
+        T* values = codec::prepareGetReply<T>(output, nValues);
+        bool inPlace = values != nullptr;
+        if (!inPlace) {
+            values = valueBuffer<T>(*set, nValues);
         }
 
-        fmi3Status status = fmu::fmi3SetBinary(
-            getInstance(input.instance_index()),
-            value_references.get(),
-            input.n_value_references(),
-            value_sizes.get(),
-            reinterpret_cast<const fmi3Binary*>(values.data()),
-            values.size()        
+        fmi3Status status = fmi3Get(
+            getInstance(model, header.instance_index),
+            set->valueReferences.data(),
+            set->valueReferences.size(),
+            values,
+            nValues
         );
-        
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
 
-     
+        if (inPlace) {
+            codec::finishGetReply(output, header.type, transformToProtoStatus(status), nValues);
+        } else {
+            codec::encodeGetReply(output, header.type, transformToProtoStatus(status), values, nValues);
+        }
     }
 
-    void fmi3GetBinary(const zenoh::Query& query) {
-        printQuery(query);
+    template <typename T, typename SetFunction>
+    void setCompactValues(Model& model, SetFunction* fmi3Set, const codec::Header& header, const uint8_t* input, size_t size, std::string& output) {
+        thread_local ValueReferenceSet scratch;
+        size_t offset;
+        ValueReferenceSet* set = resolveValueReferences(model, header, input, size, scratch, offset);
+        size_t nValues = header.n_values;
+        if (!set || !validValueCount(model, set->valueReferences.size(), nValues) || size < offset + codec::valuesSize<T>(nValues)) {
+            codec::encodeStatusReply(output, header.type, proto::ERROR);
+            return;
+        }
+        const T* values = codec::inPlaceValues<T>(input + offset);
+        if (!values) {
+            T* converted = valueBuffer<T>(*set, nValues);
+            codec::readValues(converted, input + offset, nValues);
+            values = converted;
+        }
 
-        proto::fmi3GetBinaryInputMessage input;
-        PARSE_QUERY(query, input)
+        fmi3Status status = fmi3Set(
+            getInstance(model, header.instance_index),
+            set->valueReferences.data(),
+            set->valueReferences.size(),
+            values,
+            nValues
+        );
 
-        size_t nValueReferences = input.n_value_references();
-        std::unique_ptr<fmi3ValueReference[]> value_references(new fmi3ValueReference[input.n_value_references()]);
-        std::unique_ptr<size_t[]> value_sizes(new size_t[nValueReferences]);
-        std::unique_ptr<fmi3Binary[]> values(new fmi3Binary[nValueReferences * MAX_BINARY_SIZE]); // Assuming MAX_BINARY_SIZE is defined
-        size_t n_value = 0;
+        codec::encodeStatusReply(output, header.type, transformToProtoStatus(status));
+    }
 
-        for (size_t i = 0; i < nValueReferences; ++i) {
-            value_references[i] = input.value_references()[i];
+    void fmi3GetCompact(Model& model, const uint8_t* input, size_t size, std::string& output) {
+        codec::Header header;
+        if (codec::readHeader(input, size, header)) {
+            switch (header.type) {
+                COMPACT_GET_CASE(Float32)
+                COMPACT_GET_CASE(Float64)
+                COMPACT_GET_CASE(Int8)
+                COMPACT_GET_CASE(UInt8)
+                COMPACT_GET_CASE(Int16)
+                COMPACT_GET_CASE(UInt16)
+                COMPACT_GET_CASE(Int32)
+                COMPACT_GET_CASE(UInt32)
+                COMPACT_GET_CASE(Int64)
+                COMPACT_GET_CASE(UInt64)
+                COMPACT_GET_CASE(Boolean)
+            }
         }
+        spdlog::error("Malformed compact fmi3Get request.");
+        codec::encodeStatusReply(output, header.type, proto::ERROR);
+    }
 
-        fmi3Status status = fmu::fmi3GetBinary(
-            getInstance(input.instance_index()),
-            value_references.get(),
-            nValueReferences,
-            value_sizes.get(),
-            values.get(),
-            n_value
-        );
+    void fmi3SetCompact(Model& model, const uint8_t* input, size_t size, std::string& output) {
+        codec::Header header;
+        if (codec::readHeader(input, size, header)) {
+            switch (header.type) {
+                COMPACT_SET_CASE(Float32)
+                COMPACT_SET_CASE(Float64)
+                COMPACT_SET_CASE(Int8)
+                COMPACT_SET_CASE(UInt8)
+                COMPACT_SET_CASE(Int16)
+                COMPACT_SET_CASE(UInt16)
+                COMPACT_SET_CASE(Int32)
+                COMPACT_SET_CASE(UInt32)
+                COMPACT_SET_CASE(Int64)
+                COMPACT_SET_CASE(UInt64)
+                COMPACT_SET_CASE(Boolean)
+            }
+        }
+        spdlog::error("Malformed compact fmi3Set request.");
+        codec::encodeStatusReply(output, header.type, proto::ERROR);
+    }
 
-        proto::fmi3GetBinaryOutputMessage output;
-        size_t offset = 0;
-        for (size_t i = 0; i < nValueReferences; ++i) {
-            std::string binaryValue(reinterpret_cast<const char*>(values.get() + offset), value_sizes[i]);
-            output.add_values(binaryValue);
-            offset += value_sizes[i];
+    // Runs a Set call of an exchange or call batch.
+    proto::Status setValue(Model& model, const proto::fmi3SetValueMessage& set_value) {
+        proto::fmi3StatusMessage set_output;
+        set_output.set_status(proto::ERROR);
+        EXCHANGE_SET_VALUE(Float32, float32)
+        EXCHANGE_SET_VALUE(Float64, float64)
+        EXCHANGE_SET_VALUE(Int8, int8)
+        EXCHANGE_SET_VALUE(UInt8, uint8)
+        EXCHANGE_SET_VALUE(Int16, int16)
+        EXCHANGE_SET_VALUE(UInt16, uint16)
+        EXCHANGE_SET_VALUE(Int32, int32)
+        EXCHANGE_SET_VALUE(UInt32, uint32)
+        EXCHANGE_SET_VALUE(Int64, int64)
+        EXCHANGE_SET_VALUE(UInt64, uint64)
+        EXCHANGE_SET_VALUE(Boolean, boolean)
+        EXCHANGE_SET_VALUE(String, string)
+        if (set_value.has_compact()) {
+            // Reused like the output of the compact callbacks, whose header
+            // is longer than the small-string buffer
+            thread_local std::string compact_output;
+            compact_output.clear();
+            fmi3SetCompact(model, codec::bufferData(set_value.compact()), set_value.compact().size(), compact_output);
+            set_output.set_status(static_cast<proto::Status>(compact_output[codec::STATUS_OFFSET]));
         }
-        output.set_status(transformToProtoStatus(status));
+        return set_output.status();
+    }
 
-        SERIALIZE_REPLY(query, output)
+    void fmi3Exchange(Model& model, const proto::fmi3ExchangeInputMessage& input, proto::fmi3ExchangeOutputMessage& output) {
+        proto::Status status = proto::OK;
 
-    }
+        for (const auto& set_value : input.set_values()) {
+            status = std::max(status, setValue(model, set_value));
+            if (status >= proto::ERROR) {
+                output.set_status(status);
+                return;
+            }
+        }
 
-    
-    void fmi3Reset(const zenoh::Query& query) {
-        printQuery(query);
+        if (input.has_do_step()) {
+            fmi3DoStep(model, input.do_step(), *output.mutable_do_step());
+            status = std::max(status, output.do_step().status());
+            if (status >= proto::ERROR) {
+                output.set_status(status);
+                return;
+            }
+        }
 
-        proto::fmi3InstanceMessage input;
-        PARSE_QUERY(query, input)
+        // The status of each Get is reported with its own values
+        for (const auto& get_value : input.get_values()) {
+            proto::fmi3GetValueOutputMessage& get_output = *output.add_get_values();
+            EXCHANGE_GET_VALUE(Float32, float32)
+            EXCHANGE_GET_VALUE(Float64, float64)
+            EXCHANGE_GET_VALUE(Int8, int8)
+            EXCHANGE_GET_VALUE(UInt8, uint8)
+            EXCHANGE_GET_VALUE(Int16, int16)
+            EXCHANGE_GET_VALUE(UInt16, uint16)
+            EXCHANGE_GET_VALUE(Int32, int32)
+            EXCHANGE_GET_VALUE(UInt32, uint32)
+            EXCHANGE_GET_VALUE(Int64, int64)
+            EXCHANGE_GET_VALUE(UInt64, uint64)
+            EXCHANGE_GET_VALUE(Boolean, boolean)
+            EXCHANGE_GET_VALUE(String, string)
+            if (get_value.has_compact()) {
+                fmi3GetCompact(model, codec::bufferData(get_value.compact()), get_value.compact().size(), *get_output.mutable_compact());
+            }
+        }
 
-        fmi3Status status = fmu::fmi3Reset(getInstance(input.instance_index()));
+        output.set_status(status);
+    }
 
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+    void fmi3CallBatch(Model& model, const proto::fmi3CallBatchInputMessage& input, proto::fmi3CallBatchOutputMessage& output) {
+        proto::Status status = proto::OK;
+        for (const auto& call : input.calls()) {
+            proto::fmi3StatusMessage call_output;
+            call_output.set_status(proto::ERROR);
+            if (call.has_set_value()) {
+                call_output.set_status(setValue(model, call.set_value()));
+            } else if (call.has_enter_initialization_mode()) {
+                fmi3EnterInitializationMode(model, call.enter_initialization_mode(), call_output);
+            } else if (call.has_exit_initialization_mode()) {
+                fmi3ExitInitializationMode(model, call.exit_initialization_mode(), call_output);
+            } else if (call.has_enter_event_mode()) {
+                fmi3EnterEventMode(model, call.enter_event_mode(), call_output);
+            }
+            output.add_statuses(call_output.status());
+            status = std::max(status, call_output.status());
+            if (status >= proto::ERROR) {
+                break;
+            }
+        }
+        output.set_status(status);
     }
 
+}
+
+
+namespace callbacks {
+
+    DEFINE_QUERY_CALLBACK(fmi3SetDebugLogging, proto::fmi3SetDebugLoggingMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3InstantiateCoSimulation, proto::fmi3InstantiateCoSimulationMessage, proto::fmi3InstanceMessage)
+    DEFINE_QUERY_CALLBACK(fmi3InstantiateModelExchange, proto::fmi3InstantiateModelExchangeMessage, proto::fmi3InstanceMessage)
+    DEFINE_QUERY_CALLBACK(fmi3InstantiateScheduledExecution, proto::fmi3InstantiateScheduledExecutionMessage, proto::fmi3InstanceMessage)
+    DEFINE_QUERY_CALLBACK(fmi3EnterEventMode, proto::fmi3InstanceMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3EnterInitializationMode, proto::fmi3EnterInitializationModeMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3ExitInitializationMode, proto::fmi3InstanceMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3FreeInstance, proto::fmi3InstanceMessage, proto::voidMessage)
+    DEFINE_QUERY_CALLBACK(fmi3RegisterValueReferences, proto::fmi3RegisterValueReferencesMessage, proto::fmi3ValueReferencesHandleMessage)
+    DEFINE_QUERY_CALLBACK(fmi3DoStep, proto::fmi3DoStepMessage, proto::fmi3DoStepOutputMessage)
+
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Float32)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Float64)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Int8)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(UInt8)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Int16)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(UInt16)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Int32)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(UInt32)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Int64)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(UInt64)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(Boolean)
+    DEFINE_FMI3_VALUE_QUERY_CALLBACKS(String)
+
+    DEFINE_QUERY_CALLBACK(fmi3SetClock, proto::fmi3SetClockInputMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3GetClock, proto::fmi3GetClockInputMessage, proto::fmi3GetClockOutputMessage)
+    DEFINE_QUERY_CALLBACK(fmi3SetBinary, proto::fmi3SetBinaryInputMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3GetBinary, proto::fmi3GetBinaryInputMessage, proto::fmi3GetBinaryOutputMessage)
+    DEFINE_QUERY_CALLBACK(fmi3Reset, proto::fmi3InstanceMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3Terminate, proto::fmi3InstanceMessage, proto::fmi3StatusMessage)
+    DEFINE_QUERY_CALLBACK(fmi3Exchange, proto::fmi3ExchangeInputMessage, proto::fmi3ExchangeOutputMessage)
+    DEFINE_QUERY_CALLBACK(fmi3CallBatch, proto::fmi3CallBatchInputMessage, proto::fmi3CallBatchOutputMessage)
+    DEFINE_COMPACT_QUERY_CALLBACK(fmi3GetCompact)
+    DEFINE_COMPACT_QUERY_CALLBACK(fmi3SetCompact)
+
+    // State of a batch shared by its exchanges. The last exchange to finish
+    // sends the reply.
+    struct PendingBatch {
+        proto::fmi3BatchExchangeInputMessage input;
+        proto::fmi3BatchExchangeOutputMessage output;
+        std::unique_ptr<zenoh::Query> query;
+        std::atomic<size_t> remaining{0};
+        uint64_t received = 0;
+        uint64_t decoded = 0;
+        size_t bytesIn = 0;
+    };
 
-    void fmi3Terminate(const zenoh::Query& query) {
+    // The exchanges of a batch are dispatched to the strands of their
+    // instances, so they run in parallel across the workers. Each exchange is
+    // recorded in the statistics of its instance, and the whole batch, from
+    // dispatch to the last exchange, as the fmu phase of the model.
+    void fmi3BatchExchange(Model& model, size_t rpc, const zenoh::Query& query) {
+        auto batch = std::make_shared<PendingBatch>();
+        batch->received = stats::now();
         printQuery(query);
+        PARSE_QUERY(query, batch->input)
+        batch->bytesIn = payloadSize(query);
+        batch->query = std::make_unique<zenoh::Query>(query.clone());
 
-        proto::fmi3InstanceMessage input;
-        PARSE_QUERY(query, input)
+        int nExchanges = batch->input.exchanges_size();
+        for (int i = 0; i < nExchanges; ++i) {
+            batch->output.add_exchanges();
+        }
+        batch->remaining = nExchanges + 1;
+        batch->decoded = stats::now();
 
-        fmi3Status status = fmu::fmi3Terminate(getInstance(input.instance_index()));
+        auto finish = [&model, rpc, batch]() {
+            if (--batch->remaining > 0) {
+                return;
+            }
+            proto::Status status = proto::OK;
+            for (const auto& exchange : batch->output.exchanges()) {
+                status = std::max(status, exchange.status());
+            }
+            batch->output.set_status(status);
+            uint64_t handled = stats::now();
+            SERIALIZE_REPLY((*batch->query), batch->output)
+            const uint64_t durations[N_SERVER_PHASES] = {batch->decoded - batch->received, 0, handled - batch->decoded, stats::now() - handled};
+            model.rpcStats.get(rpc).record(durations, batch->bytesIn, batch->output.GetCachedSize());
+        };
 
-        proto::fmi3StatusMessage output = makeFmi3StatusMessage(status);
-        SERIALIZE_REPLY(query, output)
+        for (int i = 0; i < nExchanges; ++i) {
+            int instance_index = batch->input.exchanges(i).instance_index();
+            dispatch(model, instance_index, [&model, rpc, batch, i, instance_index, finish]() {
+                uint64_t started = stats::now();
+                // A failed exchange, e.g. of a stale instance, fails alone
+                proto::fmi3ExchangeOutputMessage& exchange = *batch->output.mutable_exchanges(i);
+                try {
+                    handlers::fmi3Exchange(model, batch->input.exchanges(i), exchange);
+                } catch (const std::exception& e) {
+                    spdlog::error("Exchange {} of a batch for instance {} failed: {}", i, instance_index, e.what());
+                    exchange.Clear();
+                    exchange.set_status(proto::ERROR);
+                }
+                InstanceSlot* slot = findInstanceSlot(model, instance_index);
+                if (slot && slot->stats) {
+                    const uint64_t durations[N_SERVER_PHASES] = {0, started - batch->decoded, stats::now() - started, 0};
+                    slot->stats->get(rpc).record(durations, 0, 0);
+                }
+                finish();
+            });
+        }
+        finish();
     }
 
 }
@@ -752,122 +2171,246 @@ std::string constructLibraryPath(const std::string& tempPath, const std::string&
 #endif
 }
 
-int startServer(const std::string& fmuPath, const std::string& responderId, const std::string& zenohConfigPath, bool debug) {
+// Extracts the FMU of a model and binds the functions of its library.
+void loadModel(Model& model) {
+    std::filesystem::path fmuFilePath(model.fmuPath);
+    std::string modelName = fmuFilePath.stem().string();
+    model.tempPath = unzipFmu(model.fmuPath);
+    std::string libPath = constructLibraryPath(model.tempPath, modelName);
+
+    // Set the resource path
+    model.resourcePath = model.tempPath + "/resources";
+
+    // Load the FMU library dynamically
+    model.library = loadFmuLibrary(libPath);
+
+    // Bind FMU library functions
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetDebugLogging, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateCoSimulation, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateModelExchange, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateScheduledExecution, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3EnterEventMode, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3EnterInitializationMode, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3ExitInitializationMode, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3FreeInstance, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3DoStep, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetFloat32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetFloat32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetFloat64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetFloat64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt8, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt8, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt8, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt8, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt16, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt16, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt16, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt16, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt32, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt64, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetBoolean, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetBoolean, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetString, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetString, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetClock, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetClock, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3SetBinary, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3GetBinary, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3Reset, model)
+    BIND_FMU_LIBRARY_FUNCTION(fmi3Terminate, model)
+
+    // An FMU that can be instantiated only once per process keeps global
+    // state, so its calls are never run in parallel.
+    model.parallelInstances = readModelDescriptionAttribute(model.tempPath + "/modelDescription.xml", "canBeInstantiatedOnlyOncePerProcess") != "true";
+    if (model.poolSize > 0 && !model.parallelInstances) {
+        spdlog::warn("{} can only be instantiated once per process, its instances are not pooled.", model.fmuPath);
+        model.poolSize = 0;
+    }
+
+    for (const ModelVariable& variable : readModelVariables(model.tempPath + "/modelDescription.xml")) {
+        codec::Type type;
+        model.arrayVariables = model.arrayVariables || variable.array;
+        if (variable.array || !codec::parseType(variable.type, type)) {
+            continue;
+        }
+        if (variable.causality == "output") {
+            model.outputs[static_cast<size_t>(type)].push_back(variable.valueReference);
+        }
+#ifdef LIAISON_LOCAL_RT
+        if (variable.causality == "input" || variable.causality == "output") {
+            model.localVariables.push_back({variable.valueReference, type, variable.causality == "input" ? localrt::INPUT : localrt::OUTPUT});
+        }
+#endif
+    }
+    if (executor) {
+        model.strand = std::make_shared<Strand>(*executor);
+    }
+}
+
+// Declares the publisher and the queryables of a model on the session.
+void serveModel(Model& model) {
+    // Queryable declarations
+    DECLARE_QUERYABLE(fmi3SetDebugLogging, model)
+    DECLARE_QUERYABLE(fmi3InstantiateCoSimulation, model)
+    DECLARE_QUERYABLE(fmi3InstantiateModelExchange, model)
+    DECLARE_QUERYABLE(fmi3InstantiateScheduledExecution, model)
+    DECLARE_QUERYABLE(fmi3EnterEventMode, model)
+    DECLARE_QUERYABLE(fmi3EnterInitializationMode, model)
+    DECLARE_QUERYABLE(fmi3ExitInitializationMode, model)
+    DECLARE_QUERYABLE(fmi3FreeInstance, model)
+    DECLARE_QUERYABLE(fmi3RegisterValueReferences, model)
+    DECLARE_QUERYABLE(fmi3DoStep, model)
+    DECLARE_QUERYABLE(fmi3SetFloat32, model)
+    DECLARE_QUERYABLE(fmi3GetFloat32, model)
+    DECLARE_QUERYABLE(fmi3SetFloat64, model)
+    DECLARE_QUERYABLE(fmi3GetFloat64, model)
+    DECLARE_QUERYABLE(fmi3SetInt8, model)
+    DECLARE_QUERYABLE(fmi3GetInt8, model)
+    DECLARE_QUERYABLE(fmi3SetUInt8, model)
+    DECLARE_QUERYABLE(fmi3GetUInt8, model)
+    DECLARE_QUERYABLE(fmi3SetInt16, model)
+    DECLARE_QUERYABLE(fmi3GetInt16, model)
+    DECLARE_QUERYABLE(fmi3SetUInt16, model)
+    DECLARE_QUERYABLE(fmi3GetUInt16, model)
+    DECLARE_QUERYABLE(fmi3SetInt32, model)
+    DECLARE_QUERYABLE(fmi3GetInt32, model)
+    DECLARE_QUERYABLE(fmi3SetUInt32, model)
+    DECLARE_QUERYABLE(fmi3GetUInt32, model)
+    DECLARE_QUERYABLE(fmi3SetInt64, model)
+    DECLARE_QUERYABLE(fmi3GetInt64, model)
+    DECLARE_QUERYABLE(fmi3SetUInt64, model)
+    DECLARE_QUERYABLE(fmi3GetUInt64, model)
+    DECLARE_QUERYABLE(fmi3SetBoolean, model)
+    DECLARE_QUERYABLE(fmi3GetBoolean, model)
+    DECLARE_QUERYABLE(fmi3SetString, model)
+    DECLARE_QUERYABLE(fmi3GetString, model)
+    DECLARE_QUERYABLE(fmi3SetClock, model)
+    DECLARE_QUERYABLE(fmi3GetClock, model)
+    DECLARE_QUERYABLE(fmi3SetBinary, model)
+    DECLARE_QUERYABLE(fmi3GetBinary, model)
+    DECLARE_QUERYABLE(fmi3Reset, model)
+    DECLARE_QUERYABLE(fmi3Terminate, model)
+    DECLARE_QUERYABLE(fmi3Exchange, model)
+    DECLARE_QUERYABLE(fmi3BatchExchange, model)
+    DECLARE_QUERYABLE(fmi3CallBatch, model)
+    DECLARE_QUERYABLE(fmi3GetCompact, model)
+    DECLARE_QUERYABLE(fmi3SetCompact, model)
+
+    // Statistics queryable, answered on the Zenoh thread
+    zenoh::KeyExpr keyexpr_stats("rpc/" + model.responderId + "/__stats");
+    auto on_drop_queryable_stats = []() { spdlog::debug("Destroying queryable for __stats"); };
+    auto callback_stats = [&model](const zenoh::Query& query) {
+        printQuery(query);
+        query.reply(query.get_keyexpr(), zenoh::Bytes(modelStats(model).dump()));
+    };
+    model.queryables.push_back(session->declare_queryable(keyexpr_stats, std::function<void(const zenoh::Query&)>(callback_stats), on_drop_queryable_stats));
+}
+
+// Writes the statistics of all models, replacing the file at once.
+void writeStats(const std::vector<std::unique_ptr<Model>>& models, const std::string& statsFile) {
+    json result = json::object();
+    for (const auto& model : models) {
+        result[model->responderId] = modelStats(*model);
+    }
+    std::string tempFile = statsFile + ".tmp";
+    {
+        std::ofstream o(tempFile);
+        o << result.dump(4) << std::endl;
+    }
+    std::error_code error;
+    std::filesystem::rename(tempFile, statsFile, error);
+    if (error) {
+        spdlog::error("Failed to write statistics to {}: {}", statsFile, error.message());
+    }
+}
+
+int startServer(const std::vector<std::pair<std::string, std::string>>& fmus, const std::string& zenohConfigPath, bool debug, size_t workers, size_t poolSize, bool deterministic, const std::string& statsFile, size_t statsInterval, size_t sharedMemorySize, double logRate) {
+    std::string served;
+    for (const auto& fmu : fmus) {
+        served += fmt::format("FMU: {}\nResponder ID: {}\n", fmu.first, fmu.second);
+    }
     spdlog::info("\n"
              "====================================\n"
-             "Serving FMU\n"
+             "Serving {}\n"
              "====================================\n"
-             "FMU: {}\n"
-             "Responder ID: {}\n"
+             "{}"
+             "Workers: {}\n"
+             "Log rate: {}\n"
+             "{}"
+             "{}"
+             "{}"
+             "{}"
              "{}"
              "{}"
              "====================================",
-             fmuPath, 
-             responderId, 
+             (fmus.size() == 1 ? "FMU" : fmt::format("{} FMUs", fmus.size())),
+             served,
+             workers,
+             (logRate > 0 ? fmt::format("{} messages/s per category", logRate) : "unlimited"),
+             (poolSize > 0 ? fmt::format("Instance pool: {}\n", poolSize) : ""),
+             (deterministic ? "Deterministic: Get results may be cached by clients\n" : ""),
+             (sharedMemorySize > 0 ? fmt::format("Shared memory: {} MiB\n", sharedMemorySize) : ""),
+             (!statsFile.empty() ? fmt::format("Statistics file: {} (every {} s)\n", statsFile, statsInterval) : ""),
              (!zenohConfigPath.empty() ? fmt::format("Zenoh config file: {}\n", zenohConfigPath) : ""),
              (debug ? "DEBUG ENABLED\n" : ""));
 
-    // Load the FMU library
-    std::filesystem::path fmuFilePath(fmuPath);
-    std::string modelName = fmuFilePath.stem().string();
-    std::string tempPath = unzipFmu(fmuPath);
-    std::string libPath = constructLibraryPath(tempPath, modelName);
+    std::random_device random;
+    serverId = (static_cast<uint64_t>(random()) << 32) | random();
 
-    // Set the resource path
-    std::string resourcePathStr = tempPath + "/resources";
-    resourcePath = std::make_unique<fmi3String>(resourcePathStr.c_str());
-    
-    // Load the FMU library dynamically
-    auto fmuLibrary = loadFmuLibrary(libPath);
+    // Start the workers, shared by all models
+    if (workers > 0) {
+        executor = std::make_unique<Executor>(workers);
+    }
 
-    // Bind FMU library functions
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetDebugLogging)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateCoSimulation)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateModelExchange)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3InstantiateScheduledExecution)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3EnterEventMode)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3EnterInitializationMode)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3ExitInitializationMode)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3FreeInstance)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3DoStep)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetFloat32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetFloat32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetFloat64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetFloat64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt8)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt8)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt8)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt8)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt16)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt16)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt16)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt16)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt32)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetInt64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetInt64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetUInt64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetUInt64)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetBoolean)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetBoolean)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetString)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetString)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3SetClock)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3GetClock)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3Reset)
-    BIND_FMU_LIBRARY_FUNCTION(fmi3Terminate)
+    // Load the FMU libraries, each with its own function table
+    std::vector<std::unique_ptr<Model>> models;
+    for (const auto& fmu : fmus) {
+        auto model = std::make_unique<Model>();
+        model->fmuPath = fmu.first;
+        model->responderId = fmu.second;
+        model->poolSize = poolSize;
+        // Nothing in the model description tells that the outputs only change
+        // through calls (wall-clock time, hardware or other I/O may change
+        // them), so the Get cache of the clients is enabled on request only.
+        model->deterministic = deterministic;
+        models.push_back(std::move(model));
+        loadModel(*models.back());
+    }
 
     // Start Zenoh Session
     zenoh::Config zconfig = zenohConfigPath.empty() ? zenoh::Config::create_default() : zenoh::Config::from_file(zenohConfigPath);
+#ifdef LIAISON_SHARED_MEMORY
+    if (sharedMemorySize > 0) {
+        payload::enableSharedMemory(zconfig);
+        sharedMemory = std::make_unique<payload::SharedMemory>(sharedMemorySize << 20);
+    }
+#endif
     session = std::make_unique<zenoh::Session>(zenoh::Session::open(std::move(zconfig)));
 
-    // LogMessage publisher declaration
-    std::string expr_fmi3LogMessage = "rpc/" + responderId + "/fmi3LogMessage";
-    zenoh::KeyExpr keyexpr_fmi3LogMessage(expr_fmi3LogMessage);
-    fmi3LogMessagePublisher = std::make_unique<zenoh::Publisher>(session->declare_publisher(keyexpr_fmi3LogMessage));
+    logPipeline = std::make_unique<LogPipeline>(logRate);
+    for (auto& model : models) {
+        serveModel(*model);
+    }
 
-    // Queryable declarations
-    DECLARE_QUERYABLE(fmi3SetDebugLogging, responderId) 
-    DECLARE_QUERYABLE(fmi3InstantiateCoSimulation, responderId)
-    DECLARE_QUERYABLE(fmi3InstantiateModelExchange, responderId)
-    DECLARE_QUERYABLE(fmi3InstantiateScheduledExecution, responderId)
-    DECLARE_QUERYABLE(fmi3EnterEventMode, responderId)
-    DECLARE_QUERYABLE(fmi3EnterInitializationMode, responderId)
-    DECLARE_QUERYABLE(fmi3ExitInitializationMode, responderId)
-    DECLARE_QUERYABLE(fmi3FreeInstance, responderId)
-    DECLARE_QUERYABLE(fmi3DoStep, responderId)
-    DECLARE_QUERYABLE(fmi3SetFloat32, responderId)
-    DECLARE_QUERYABLE(fmi3GetFloat32, responderId)
-    DECLARE_QUERYABLE(fmi3SetFloat64, responderId)
-    DECLARE_QUERYABLE(fmi3GetFloat64, responderId)
-    DECLARE_QUERYABLE(fmi3SetInt8, responderId)
-    DECLARE_QUERYABLE(fmi3GetInt8, responderId)
-    DECLARE_QUERYABLE(fmi3SetUInt8, responderId)
-    DECLARE_QUERYABLE(fmi3GetUInt8, responderId)
-    DECLARE_QUERYABLE(fmi3SetInt16, responderId)
-    DECLARE_QUERYABLE(fmi3GetInt16, responderId)
-    DECLARE_QUERYABLE(fmi3SetUInt16, responderId)
-    DECLARE_QUERYABLE(fmi3GetUInt16, responderId)
-    DECLARE_QUERYABLE(fmi3SetInt32, responderId)
-    DECLARE_QUERYABLE(fmi3GetInt32, responderId)
-    DECLARE_QUERYABLE(fmi3SetUInt32, responderId)
-    DECLARE_QUERYABLE(fmi3GetUInt32, responderId)
-    DECLARE_QUERYABLE(fmi3SetInt64, responderId)
-    DECLARE_QUERYABLE(fmi3GetInt64, responderId)
-    DECLARE_QUERYABLE(fmi3SetUInt64, responderId)
-    DECLARE_QUERYABLE(fmi3GetUInt64, responderId)
-    DECLARE_QUERYABLE(fmi3SetBoolean, responderId)
-    DECLARE_QUERYABLE(fmi3GetBoolean, responderId)
-    DECLARE_QUERYABLE(fmi3SetString, responderId)
-    DECLARE_QUERYABLE(fmi3GetString, responderId)
-    DECLARE_QUERYABLE(fmi3SetClock, responderId)
-    DECLARE_QUERYABLE(fmi3GetClock, responderId)
-    DECLARE_QUERYABLE(fmi3SetBinary, responderId)
-    DECLARE_QUERYABLE(fmi3GetBinary, responderId)
-    DECLARE_QUERYABLE(fmi3Reset, responderId)
-    DECLARE_QUERYABLE(fmi3Terminate, responderId)
+    // Periodic dump of the statistics
+    std::mutex statsWriterMutex;
+    std::condition_variable statsWriterWakeUp;
+    bool stopping = false;
+    std::thread statsWriter;
+    if (!statsFile.empty()) {
+        statsWriter = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(statsWriterMutex);
+            while (!statsWriterWakeUp.wait_for(lock, std::chrono::seconds(statsInterval), [&]() { return stopping; })) {
+                writeStats(models, statsFile);
+            }
+        });
+    }
 
     spdlog::info("Liaison server is now listening!");
     spdlog::info("Enter 'q' to quit...");
@@ -883,16 +2426,20 @@ int startServer(const std::string& fmuPath, const std::string& responderId, cons
         }
     }
 
-    // Reset shared pointer
-    spdlog::debug("Cleaning up publishers ...");
-    if (fmi3LogMessagePublisher) {
-        try {
-            std::move(*fmi3LogMessagePublisher).undeclare();
-        } catch (const std::exception& e) {
-            spdlog::error("Error undeclaring fmi3LogMessage publisher: {}", e.what());
+    if (statsWriter.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(statsWriterMutex);
+            stopping = true;
         }
+        statsWriterWakeUp.notify_all();
+        statsWriter.join();
+        writeStats(models, statsFile);
     }
 
+    // Later messages are only printed
+    spdlog::debug("Stopping the log pipeline and its publishers ...");
+    logPipeline->stop();
+
     spdlog::debug("Closing Zenoh session ...");
     if (session) {
         try {
@@ -902,22 +2449,56 @@ int startServer(const std::string& fmuPath, const std::string& responderId, cons
         }
     }
 
+    // The workers run the queued tasks before they stop, so the strands are
+    // reset after them. A pool refill still running no longer posts.
+    spdlog::debug("Stopping workers ...");
+    poolRefillsStopped = true;
+    executor.reset();
+    for (auto& model : models) {
+        model->strand.reset();
+    }
+
+    // The live instances of a model are the keys of its instance statistics
+    spdlog::debug("Stopping local real-time instances and output publishers ...");
+    for (auto& model : models) {
+        std::lock_guard<std::mutex> lock(model->statsMutex);
+        for (const auto& entry : model->instanceStats) {
+            InstanceSlot* slot = findInstanceSlot(*model, entry.first);
+            if (slot) {
+                slot->localRealTime.reset();
+                slot->pushedOutputs.reset();
+            }
+        }
+    }
+
+    spdlog::debug("Freeing pooled instances ...");
+    for (auto& model : models) {
+        if (model->poolSize > 0) {
+            spdlog::info("Instance pool of {}: {} hits, {} misses", model->responderId, model->poolHits.load(), model->poolMisses.load());
+        }
+        freePooledInstances(*model);
+    }
+
     spdlog::debug("Cleaning up resources ...");
-    resourcePath.reset();
+    for (auto& model : models) {
+        model->queryables.clear();
+    }
     session.reset();
-    fmi3LogMessagePublisher.reset();
-
-    // Unload the FMU library before exiting
-    spdlog::debug("Unloading FMU library ...");
-    if (fmuLibrary) {
-        unloadFmuLibrary(fmuLibrary);
-        fmuLibrary = nullptr;
+    sharedMemory.reset();
+    logPipeline.reset();
+
+    // Unload the FMU libraries before exiting
+    spdlog::debug("Unloading FMU libraries ...");
+    for (auto& model : models) {
+        if (model->library) {
+            unloadFmuLibrary(model->library);
+            model->library = nullptr;
+        }
     }
 
     return 0;
 }
 
-
 void makeFmu(const std::string& fmuPath, const std::string& responderId, const std::string& zenohConfigPath) {
     spdlog::info("\n"
              "====================================\n"
@@ -1105,15 +2686,72 @@ void makeFmu(const std::string& fmuPath, const std::string& responderId, const s
 }
 
 
+// Reads the FMUs to serve from a manifest:
+//   {"fmus": [{"path": "<Path to FMU>", "responderId": "<Responder Id>"}, ...]}
+// Relative paths are resolved against the directory of the manifest.
+std::vector<std::pair<std::string, std::string>> readManifest(const std::string& manifestPath) {
+    std::ifstream file(manifestPath);
+    if (!file.is_open()) {
+        std::ostringstream oss;
+        oss << "Manifest file does not exist at: " << manifestPath;
+        throw std::runtime_error(oss.str());
+    }
+    json manifest;
+    try {
+        file >> manifest;
+    } catch (const json::exception& e) {
+        std::ostringstream oss;
+        oss << "Failed to parse manifest " << manifestPath << ": " << e.what();
+        throw std::runtime_error(oss.str());
+    }
+    if (!manifest.contains("fmus") || !manifest["fmus"].is_array() || manifest["fmus"].empty()) {
+        throw std::runtime_error("The manifest must list the FMUs to serve in 'fmus'.");
+    }
+
+    std::filesystem::path manifestDir = std::filesystem::path(manifestPath).parent_path();
+    std::vector<std::pair<std::string, std::string>> fmus;
+    std::set<std::string> responderIds;
+    for (const auto& entry : manifest["fmus"]) {
+        if (!entry.contains("path") || !entry.contains("responderId")) {
+            throw std::runtime_error("Every FMU of the manifest needs a 'path' and a 'responderId'.");
+        }
+        std::filesystem::path fmuPath = entry["path"].get<std::string>();
+        if (fmuPath.is_relative()) {
+            fmuPath = manifestDir / fmuPath;
+        }
+        if (!std::filesystem::exists(fmuPath)) {
+            std::ostringstream oss;
+            oss << "FMU does not exist at: " << fmuPath.string();
+            throw std::runtime_error(oss.str());
+        }
+        std::string responderId = entry["responderId"].get<std::string>();
+        if (!responderIds.insert(responderId).second) {
+            std::ostringstream oss;
+            oss << "Responder ID listed twice in the manifest: " << responderId;
+            throw std::runtime_error(oss.str());
+        }
+        fmus.emplace_back(fmuPath.string(), responderId);
+    }
+    return fmus;
+}
+
+
 void printUsage() {
     std::cout <<"Usage:\n";
     std::cout <<"  liaison --serve <Path to FMU> <Responder Id>\n";
+    std::cout <<"  liaison --serve <Path to manifest JSON file>\n";
     std::cout <<"  liaison --make-fmu <Path to FMU> <Responder Id>\n";
     std::cout <<"  liaison --make-fmu <Path to FMU> <Responder Id> --debug\n";
     std::cout <<"  liaison --make-fmu <Path to FMU> <Responder Id> --debug-zenoh\n";
     std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --zenoh-config <Path to Zenoh config file>\n";
     std::cout <<"  liaison --make-fmu <Path to FMU> <Responder Id> --zenoh-config <Path to Zenoh config file>\n";
     std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --python-env <Path to Python environment>\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --workers <Number of worker threads, 0 to run on the Zenoh threads>\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --pool <Number of warm instances per instantiation>\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --deterministic (outputs only change through calls, clients may cache them)\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --stats-file <Path to JSON file> --stats-interval <Seconds>\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --log-rate <FMU log messages per second and category, 0 for no limit>\n";
+    std::cout <<"  liaison --serve <Path to FMU> <Responder Id> --shared-memory <MiB of shared memory for replies, 0 to disable>\n";
 }
 std::string findPythonLib(const std::string& dirPath, const std::string& version) {
 #ifdef _WIN32
@@ -1330,17 +2968,34 @@ int main(int argc, char* argv[]) {
     bool debug = false;
     try {
         // Parse command line arguments
-        if (argc < 4) {
+        if (argc < 3) {
             throw std::invalid_argument("Invalid number of arguments.");
         }
         std::string option = argv[1];
         std::string fmuPath = argv[2];
-        std::string responderId = argv[3];
+
+        // A server can be given a manifest of FMUs instead of an FMU and its responder ID
+        bool manifest = option == "--serve" && std::filesystem::path(fmuPath).extension() == ".json";
+        if (!manifest && argc < 4) {
+            throw std::invalid_argument("Invalid number of arguments.");
+        }
+        std::string responderId = manifest ? "" : argv[3];
 
         // Parse optional flags
         std::string zenohConfigPath;
         std::string pythonEnvPath;
-        for (int i = 4; i < argc; ++i) {
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        size_t poolSize = 0;
+        bool deterministic = false;
+        std::string statsFile;
+        size_t statsInterval = 10;
+        double logRate = DEFAULT_LOG_RATE;
+#ifdef LIAISON_SHARED_MEMORY
+        size_t sharedMemorySize = DEFAULT_SHARED_MEMORY_SIZE;
+#else
+        size_t sharedMemorySize = 0;
+#endif
+        for (int i = manifest ? 3 : 4; i < argc; ++i) {
             std::string arg = argv[i];
             if (arg == "--debug") {
                 debug = true;
@@ -1354,6 +3009,56 @@ int main(int argc, char* argv[]) {
                     oss << "Zenoh config file does not exist at: " << zenohConfigPath;
                     throw std::runtime_error(oss.str());
                 }
+            } else if (arg == "--workers" && i + 1 < argc) {
+                try {
+                    workers = std::stoul(argv[++i]);
+                } catch (const std::exception&) {
+                    std::ostringstream oss;
+                    oss << "Invalid number of workers: " << argv[i];
+                    throw std::invalid_argument(oss.str());
+                }
+            } else if (arg == "--pool" && i + 1 < argc) {
+                try {
+                    poolSize = std::stoul(argv[++i]);
+                } catch (const std::exception&) {
+                    std::ostringstream oss;
+                    oss << "Invalid instance pool size: " << argv[i];
+                    throw std::invalid_argument(oss.str());
+                }
+            } else if (arg == "--deterministic") {
+                deterministic = true;
+            } else if (arg == "--stats-file" && i + 1 < argc) {
+                statsFile = argv[++i];
+            } else if (arg == "--stats-interval" && i + 1 < argc) {
+                try {
+                    statsInterval = std::max<size_t>(1, std::stoul(argv[++i]));
+                } catch (const std::exception&) {
+                    std::ostringstream oss;
+                    oss << "Invalid statistics interval: " << argv[i];
+                    throw std::invalid_argument(oss.str());
+                }
+            } else if (arg == "--log-rate" && i + 1 < argc) {
+                try {
+                    logRate = std::stod(argv[++i]);
+                } catch (const std::exception&) {
+                    std::ostringstream oss;
+                    oss << "Invalid log rate: " << argv[i];
+                    throw std::invalid_argument(oss.str());
+                }
+            } else if (arg == "--shared-memory" && i + 1 < argc) {
+                try {
+                    sharedMemorySize = std::stoul(argv[++i]);
+                } catch (const std::exception&) {
+                    std::ostringstream oss;
+                    oss << "Invalid shared memory size: " << argv[i];
+                    throw std::invalid_argument(oss.str());
+                }
+#ifndef LIAISON_SHARED_MEMORY
+                if (sharedMemorySize > 0) {
+                    spdlog::warn("Liaison was built without LIAISON_SHARED_MEMORY, ignoring --shared-memory.");
+                    sharedMemorySize = 0;
+                }
+#endif
             } else if (arg == "--python-env" && i + 1 < argc) {
                 pythonEnvPath = argv[++i];
                 if (!std::filesystem::is_directory(pythonEnvPath)) {
@@ -1414,7 +3119,11 @@ int main(int argc, char* argv[]) {
         }
     
         if (option == "--serve") {
-            startServer(fmuPath, responderId, zenohConfigPath, debug);
+            if (manifest) {
+                startServer(readManifest(fmuPath), zenohConfigPath, debug, workers, poolSize, deterministic, statsFile, statsInterval, sharedMemorySize, logRate);
+            } else {
+                startServer({{fmuPath, responderId}}, zenohConfigPath, debug, workers, poolSize, deterministic, statsFile, statsInterval, sharedMemorySize, logRate);
+            }
         } else if (option == "--make-fmu") {
             makeFmu(fmuPath, responderId, zenohConfigPath);
         } else {
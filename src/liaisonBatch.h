@@ -0,0 +1,42 @@
+#ifndef LIAISON_BATCH_H
+#define LIAISON_BATCH_H
+
+/*
+Extension of the Liaison FMU for importers that step several instances in
+lockstep. It is not part of FMI 3.0: resolve it with dlsym or GetProcAddress
+from the binary of the Liaison FMU, next to the fmi3* functions.
+
+liaisonDoStepBatch steps the instances in a single round trip, as if
+fmi3DoStep were called on each one with the same step size. The deferred
+fmi3Set calls of each instance are sent with it and its outputs are
+prefetched, as with the exchange. The server runs the steps in parallel
+when the FMU can run instances in parallel. All instances must have been
+created by the same Liaison FMU and be in Step Mode. The results of
+instance i are written to element i of the arrays, and the most severe
+status is returned.
+*/
+
+#include "fmi3Functions.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef fmi3Status liaisonDoStepBatchTYPE(fmi3Instance instances[],
+                                          size_t nInstances,
+                                          const fmi3Float64 currentCommunicationPoints[],
+                                          fmi3Float64 communicationStepSize,
+                                          fmi3Boolean noSetFMUStatePriorToCurrentPoint,
+                                          fmi3Boolean eventHandlingNeeded[],
+                                          fmi3Boolean terminateSimulation[],
+                                          fmi3Boolean earlyReturn[],
+                                          fmi3Float64 lastSuccessfulTime[],
+                                          fmi3Status statuses[]);
+
+FMI3_Export liaisonDoStepBatchTYPE liaisonDoStepBatch;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIAISON_BATCH_H */
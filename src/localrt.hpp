@@ -0,0 +1,370 @@
+#ifndef LOCALRT_HPP
+#define LOCALRT_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "codec.hpp"
+
+
+// Local real-time mode: a co-simulation instance whose client runs on the same
+// host as the server shares a table of its scalar input and output variables,
+// sorted by value reference, in POSIX shared memory.
+//
+//   [Header][Variable 0][Variable 1]...
+//
+// In Step Mode, fmi3Set*/fmi3Get* read and write the table directly and only
+// fmi3DoStep and the other commands wake the server thread of the instance,
+// through a futex on Header::request. The server sets Header::reply to the
+// request once it is done. Values are written under a seqlock (Header::sequence).
+//
+// Inputs written by the client are marked dirty and passed to the FMU with the
+// next command. After a step the server reads every output into the table.
+
+#ifdef __linux__
+#define LIAISON_LOCAL_RT
+#endif
+
+#ifdef LIAISON_LOCAL_RT
+
+#include <cerrno>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace localrt {
+
+const uint32_t MAGIC = 0x4c525431; // "LRT1"
+const int SPIN_ITERATIONS = 4000;
+const size_t N_TYPES = codec::N_TYPES;
+
+enum class Command : uint32_t {
+    Apply,  // pass the dirty inputs to the FMU
+    Sync,   // Apply, then read every variable into the table
+    Step    // Apply, fmi3DoStep, then read the outputs
+};
+
+enum Causality : uint8_t {
+    INPUT,
+    OUTPUT
+};
+
+struct VariableInfo {
+    uint32_t valueReference;
+    codec::Type type;
+    Causality causality;
+};
+
+struct Variable {
+    uint32_t valueReference;
+    codec::Type type;
+    Causality causality;
+    std::atomic<uint8_t> dirty;
+    uint8_t reserved;
+    std::atomic<uint64_t> value; // bits of the FMI value
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t nVariables;
+    int32_t serverPid;
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> request;
+    std::atomic<uint32_t> reply;
+    Command command;
+    int32_t status; // proto::Status of the last command
+
+    // fmi3DoStep arguments and results
+    double currentCommunicationPoint;
+    double communicationStepSize;
+    uint8_t noSetFMUStatePriorToCurrentPoint;
+    uint8_t eventHandlingNeeded;
+    uint8_t terminateSimulation;
+    uint8_t earlyReturn;
+    double lastSuccessfulTime;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+    "The local table needs address-free atomics");
+
+template <typename T>
+inline uint64_t toBits(T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
+
+template <typename T>
+inline T fromBits(uint64_t bits) {
+    T value;
+    std::memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+inline long futex(std::atomic<uint32_t>& word, int op, uint32_t value, const timespec* timeout) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value, timeout, nullptr, 0);
+}
+
+// Waits until word differs from value, spinning briefly before sleeping on
+// the futex. Returns false on timeout.
+inline bool await(std::atomic<uint32_t>& word, uint32_t value, const timespec* timeout = nullptr) {
+    for (int i = 0; i < SPIN_ITERATIONS; ++i) {
+        if (word.load(std::memory_order_acquire) != value) {
+            return true;
+        }
+    }
+    while (word.load(std::memory_order_acquire) == value) {
+        if (futex(word, FUTEX_WAIT, value, timeout) < 0 && errno == ETIMEDOUT) {
+            return word.load(std::memory_order_acquire) != value;
+        }
+    }
+    return true;
+}
+
+inline void wake(std::atomic<uint32_t>& word) {
+    futex(word, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+// Mapping of a table. The server creates and unlinks it; the client opens it
+// by name.
+class Table {
+public:
+    static std::unique_ptr<Table> create(const std::string& name, const std::vector<VariableInfo>& variables) {
+        size_t size = sizeof(Header) + variables.size() * sizeof(Variable);
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, size) != 0) {
+            if (fd >= 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+            }
+            std::ostringstream oss;
+            oss << "Failed to create the local table " << name << ": " << std::strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+        std::unique_ptr<Table> table(new Table(name, fd, size, true));
+
+        Header* header = new (table->memory) Header();
+        header->nVariables = static_cast<uint32_t>(variables.size());
+        header->serverPid = getpid();
+        std::vector<VariableInfo> sorted = variables;
+        std::sort(sorted.begin(), sorted.end(), [](const VariableInfo& a, const VariableInfo& b) {
+            return a.valueReference < b.valueReference;
+        });
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            Variable* variable = new (&table->variables()[i]) Variable();
+            variable->valueReference = sorted[i].valueReference;
+            variable->type = sorted[i].type;
+            variable->causality = sorted[i].causality;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = MAGIC;
+        return table;
+    }
+
+    static std::unique_ptr<Table> open(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            std::ostringstream oss;
+            oss << "Failed to open the local table " << name << ": " << std::strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+        std::unique_ptr<Table> table(new Table(name, fd, st.st_size, false));
+        const Header& header = table->header();
+        if (header.magic != MAGIC || table->size < sizeof(Header) + header.nVariables * sizeof(Variable)) {
+            throw std::runtime_error("Invalid local table " + name);
+        }
+        return table;
+    }
+
+    ~Table() {
+        munmap(memory, size);
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    Table(const Table&) = delete;
+    Table& operator=(const Table&) = delete;
+
+    Header& header() {
+        return *static_cast<Header*>(memory);
+    }
+
+    Variable* variables() {
+        return reinterpret_cast<Variable*>(static_cast<uint8_t*>(memory) + sizeof(Header));
+    }
+
+    size_t count() {
+        return header().nVariables;
+    }
+
+    Variable* find(fmi3ValueReference valueReference) {
+        Variable* begin = variables();
+        Variable* end = begin + count();
+        Variable* variable = std::lower_bound(begin, end, valueReference, [](const Variable& v, fmi3ValueReference vr) {
+            return v.valueReference < vr;
+        });
+        return variable != end && variable->valueReference == valueReference ? variable : nullptr;
+    }
+
+    // Seqlock: writers hold an odd sequence, readers retry until they have
+    // read under one even sequence.
+    template <typename Write>
+    void write(Write&& write) {
+        std::atomic<uint32_t>& sequence = header().sequence;
+        sequence.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write();
+        sequence.fetch_add(1, std::memory_order_release);
+    }
+
+    template <typename Read>
+    void read(Read&& read) {
+        std::atomic<uint32_t>& sequence = header().sequence;
+        uint32_t before;
+        do {
+            while ((before = sequence.load(std::memory_order_acquire)) & 1) {
+            }
+            read();
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while (sequence.load(std::memory_order_relaxed) != before);
+    }
+
+    // Writes the values of scalar inputs of type T. Returns false, without
+    // writing anything, unless every value reference is such an input.
+    template <typename T>
+    bool setValues(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, const T values[], size_t nValues) {
+        if (nValues != nValueReferences || !resolve(type, valueReferences, nValueReferences, true)) {
+            return false;
+        }
+        write([&]() {
+            for (size_t i = 0; i < nValueReferences; ++i) {
+                resolved[i]->value.store(toBits(values[i]), std::memory_order_relaxed);
+                resolved[i]->dirty.store(1, std::memory_order_relaxed);
+            }
+        });
+        return true;
+    }
+
+    // Reads the values of scalar variables of type T. Returns false unless
+    // every value reference is in the table.
+    template <typename T>
+    bool getValues(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, T values[], size_t nValues) {
+        if (nValues != nValueReferences || !resolve(type, valueReferences, nValueReferences, false)) {
+            return false;
+        }
+        read([&]() {
+            for (size_t i = 0; i < nValueReferences; ++i) {
+                values[i] = fromBits<T>(resolved[i]->value.load(std::memory_order_relaxed));
+            }
+        });
+        return true;
+    }
+
+    // True if any of the value references is an output of type T.
+    bool readsOutput(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences) {
+        for (size_t i = 0; i < nValueReferences; ++i) {
+            Variable* variable = find(valueReferences[i]);
+            if (variable && variable->type == type && variable->causality == OUTPUT) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Client: sends a command and waits for the server to complete it. Returns
+    // false if the server process is gone.
+    bool call(Command command) {
+        Header& h = header();
+        h.command = command;
+        uint32_t request = h.request.fetch_add(1, std::memory_order_release) + 1;
+        wake(h.request);
+        const timespec timeout = {0, 100000000};
+        uint32_t reply;
+        while ((reply = h.reply.load(std::memory_order_acquire)) != request) {
+            if (!await(h.reply, reply, &timeout) && kill(h.serverPid, 0) != 0 && errno == ESRCH) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Server: waits for the request after handled.
+    uint32_t nextRequest(uint32_t handled) {
+        await(header().request, handled);
+        return header().request.load(std::memory_order_acquire);
+    }
+
+    // Server: completes a request.
+    void complete(uint32_t request) {
+        header().reply.store(request, std::memory_order_release);
+        wake(header().reply);
+    }
+
+    // Server: wakes its own thread, e.g. to stop it.
+    void interrupt() {
+        header().request.fetch_add(1, std::memory_order_release);
+        wake(header().request);
+    }
+
+    const std::string name;
+
+private:
+    Table(const std::string& name, int fd, size_t size, bool owner)
+        : name(name)
+        , size(size)
+        , owner(owner) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            if (owner) {
+                shm_unlink(name.c_str());
+            }
+            std::ostringstream oss;
+            oss << "Failed to map the local table " << name << ": " << std::strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+    }
+
+    bool resolve(codec::Type type, const fmi3ValueReference valueReferences[], size_t nValueReferences, bool inputsOnly) {
+        resolved.resize(nValueReferences);
+        for (size_t i = 0; i < nValueReferences; ++i) {
+            Variable* variable = find(valueReferences[i]);
+            if (!variable || variable->type != type || (inputsOnly && variable->causality != INPUT)) {
+                return false;
+            }
+            resolved[i] = variable;
+        }
+        return true;
+    }
+
+    void* memory = nullptr;
+    size_t size;
+    bool owner;
+    std::vector<Variable*> resolved;
+};
+
+} // namespace localrt
+
+#endif // LIAISON_LOCAL_RT
+
+#endif // LOCALRT_HPP
@@ -0,0 +1,127 @@
+#ifndef LOGQUEUE_HPP
+#define LOGQUEUE_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+
+// Bounded lock-free queue (Vyukov). Each cell carries a sequence number that
+// tells producers and the consumer whose turn it is, so a push is one CAS on
+// the enqueue position and no allocation. A push on a full queue fails rather
+// than waiting: the FMU thread never blocks on logging.
+template <typename T>
+class BoundedQueue {
+public:
+    // The capacity is rounded up to a power of two.
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool push(T&& value) {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& value) {
+        size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePosition{0};
+    alignas(64) std::atomic<size_t> dequeuePosition{0};
+};
+
+// Token bucket allowing rate events per second on average, in bursts of up
+// to one second worth of events. A rate of 0 allows everything.
+class RateLimiter {
+public:
+    explicit RateLimiter(double rate = 0)
+        : rate(rate)
+        , tokens(rate) {
+    }
+
+    // now is in nanoseconds.
+    bool allow(uint64_t now) {
+        if (rate <= 0) {
+            return true;
+        }
+        if (last != 0) {
+            tokens = std::min(rate, tokens + rate * (now - last) * 1e-9);
+        }
+        last = now;
+        if (tokens < 1) {
+            ++suppressed;
+            return false;
+        }
+        tokens -= 1;
+        return true;
+    }
+
+    // Events denied since the last call.
+    uint64_t takeSuppressed() {
+        return std::exchange(suppressed, 0);
+    }
+
+private:
+    double rate;
+    double tokens;
+    uint64_t last = 0;
+    uint64_t suppressed = 0;
+};
+
+
+#endif // LOGQUEUE_HPP
@@ -0,0 +1,340 @@
+#ifndef PAYLOAD_HPP
+#define PAYLOAD_HPP
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+
+#include "zenoh.hxx"
+
+#if defined(LIAISON_SHARED_MEMORY) && !(defined(Z_FEATURE_SHARED_MEMORY) && defined(Z_FEATURE_UNSTABLE_API))
+#error "LIAISON_SHARED_MEMORY requires zenoh-c built with the shared-memory and unstable-api features"
+#endif
+
+
+// Reading and writing Zenoh payloads without intermediate buffers. Received
+// payloads are read from their slices in place; outgoing payloads are
+// serialized into a buffer that Zenoh takes ownership of.
+//
+// With LIAISON_SHARED_MEMORY, outgoing payloads of SHARED_MEMORY_THRESHOLD
+// bytes or more are written to shared memory. Zenoh sends such a buffer by
+// reference to a peer on the same host, which then reads it in place, and
+// copies it to the network for other peers.
+
+namespace payload {
+
+// Outgoing payloads below this size are serialized into a reused per-thread
+// buffer, which Zenoh copies, instead of a buffer allocated for each of them.
+const size_t COPY_THRESHOLD = 16384;
+
+// Initial block of a MessageArena before it grows.
+const size_t INITIAL_ARENA_SIZE = 16384;
+
+#ifdef LIAISON_SHARED_MEMORY
+const size_t SHARED_MEMORY_THRESHOLD = 1024;
+
+// Enables shared memory in a Zenoh configuration.
+inline void enableSharedMemory(zenoh::Config& config) {
+    config.insert_json5("transport/shared_memory/enabled", "true");
+}
+
+// Pool of shared memory for outgoing payloads. It must outlive the session
+// that sends them.
+class SharedMemory {
+public:
+    explicit SharedMemory(size_t size)
+        : provider(zenoh::MemoryLayout(size, zenoh::AllocAlignment({3}))) {
+    }
+
+    // Returns false if the pool has no room left for size bytes.
+    template <typename Fill>
+    bool write(size_t size, Fill&& fill, zenoh::Bytes& bytes) {
+        auto result = provider.alloc_gc_defrag(size, zenoh::AllocAlignment({3}));
+        zenoh::ZShmMut* buffer = std::get_if<zenoh::ZShmMut>(&result);
+        if (!buffer) {
+            return false;
+        }
+        fill(buffer->data());
+        bytes = zenoh::Bytes(std::move(*buffer));
+        return true;
+    }
+
+private:
+    zenoh::PosixShmProvider provider;
+};
+#else
+class SharedMemory {};
+#endif
+
+// Protobuf input stream over the slices of a payload.
+class SliceInputStream : public google::protobuf::io::ZeroCopyInputStream {
+public:
+    explicit SliceInputStream(const zenoh::Bytes& bytes)
+        : slices(bytes.slice_iter()) {
+    }
+
+    bool Next(const void** data, int* size) override {
+        if (backedUp > 0) {
+            *data = current + currentSize - backedUp;
+            *size = backedUp;
+            position += backedUp;
+            backedUp = 0;
+            return true;
+        }
+        while (auto slice = slices.next()) {
+            if (slice->len == 0) {
+                continue;
+            }
+            current = slice->data;
+            currentSize = static_cast<int>(slice->len);
+            *data = current;
+            *size = currentSize;
+            position += currentSize;
+            return true;
+        }
+        return false;
+    }
+
+    void BackUp(int count) override {
+        backedUp = count;
+        position -= count;
+    }
+
+    bool Skip(int count) override {
+        const void* data;
+        int size;
+        while (count > 0) {
+            if (!Next(&data, &size)) {
+                return false;
+            }
+            if (size > count) {
+                BackUp(size - count);
+                return true;
+            }
+            count -= size;
+        }
+        return true;
+    }
+
+    int64_t ByteCount() const override {
+        return position;
+    }
+
+private:
+    zenoh::Bytes::SliceIterator slices;
+    const uint8_t* current = nullptr;
+    int currentSize = 0;
+    int backedUp = 0;
+    int64_t position = 0;
+};
+
+// Parses a message from a payload. Contiguous payloads, the common case, are
+// parsed directly from their single slice.
+template <typename Message>
+bool parse(const zenoh::Bytes& bytes, Message& message) {
+    auto slices = bytes.slice_iter();
+    auto first = slices.next();
+    if (!first) {
+        message.Clear();
+        return true;
+    }
+    if (!slices.next()) {
+        return message.ParseFromArray(first->data, static_cast<int>(first->len));
+    }
+    SliceInputStream stream(bytes);
+    return message.ParseFromZeroCopyStream(&stream);
+}
+
+// Contiguous view of a payload, which must outlive it. Only a fragmented
+// payload is copied.
+class View {
+public:
+    View() = default;
+
+    explicit View(const zenoh::Bytes& bytes) {
+        assign(bytes);
+    }
+
+    View(const View&) = delete;
+    View& operator=(const View&) = delete;
+
+    // Views another payload, reusing the buffer of fragmented payloads.
+    void assign(const zenoh::Bytes& bytes) {
+        clear();
+        auto slices = bytes.slice_iter();
+        auto first = slices.next();
+        if (!first) {
+            return;
+        }
+        auto next = slices.next();
+        if (!next) {
+            pointer = first->data;
+            length = first->len;
+            return;
+        }
+        fragments.assign(first->data, first->data + first->len);
+        for (; next; next = slices.next()) {
+            fragments.insert(fragments.end(), next->data, next->data + next->len);
+        }
+        pointer = fragments.data();
+        length = fragments.size();
+    }
+
+    void clear() {
+        pointer = nullptr;
+        length = 0;
+        fragments.clear();
+    }
+
+    const uint8_t* data() const {
+        return pointer;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const uint8_t* pointer = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> fragments;
+};
+
+// Whether a payload of this size goes to shared memory, when there is room.
+inline bool usesSharedMemory(size_t size, SharedMemory* sharedMemory) {
+#ifdef LIAISON_SHARED_MEMORY
+    return sharedMemory && size >= SHARED_MEMORY_THRESHOLD;
+#else
+    return false;
+#endif
+}
+
+// Writes size bytes with fill into a buffer handed over to Zenoh: shared
+// memory when available and worth it, otherwise the heap.
+template <typename Fill>
+zenoh::Bytes write(size_t size, Fill&& fill, SharedMemory* sharedMemory = nullptr) {
+#ifdef LIAISON_SHARED_MEMORY
+    zenoh::Bytes bytes;
+    if (usesSharedMemory(size, sharedMemory) && sharedMemory->write(size, fill, bytes)) {
+        return bytes;
+    }
+#endif
+    uint8_t* buffer = new uint8_t[size > 0 ? size : 1];
+    fill(buffer);
+    return zenoh::Bytes(buffer, size, [](uint8_t* data) { delete[] data; });
+}
+
+// Serializes a message into shared memory when available and worth it,
+// otherwise into a buffer handed over to Zenoh, or copied by Zenoh for small
+// messages. The copy is made by zenoh-c with its own allocator, which the
+// allocation counter of the server does not see: it is not allocation-free.
+template <typename Message>
+zenoh::Bytes serialize(const Message& message, SharedMemory* sharedMemory = nullptr) {
+    size_t size = message.ByteSizeLong();
+    auto fill = [&message](uint8_t* data) {
+        message.SerializeWithCachedSizesToArray(data);
+    };
+#ifdef LIAISON_SHARED_MEMORY
+    zenoh::Bytes bytes;
+    if (usesSharedMemory(size, sharedMemory) && sharedMemory->write(size, fill, bytes)) {
+        return bytes;
+    }
+#endif
+    if (size < COPY_THRESHOLD) {
+        thread_local std::vector<uint8_t> buffer;
+        buffer.resize(size);
+        fill(buffer.data());
+        return zenoh::Bytes(buffer);
+    }
+    return write(size, fill);
+}
+
+// Hands an encoded buffer over to Zenoh: copied once to shared memory when
+// available and worth it, copied by Zenoh below COPY_THRESHOLD and left to
+// the caller for reuse (like in serialize, that copy allocates in zenoh-c),
+// otherwise moved without a copy.
+inline zenoh::Bytes fromString(std::string&& data, SharedMemory* sharedMemory = nullptr) {
+#ifdef LIAISON_SHARED_MEMORY
+    zenoh::Bytes bytes;
+    if (usesSharedMemory(data.size(), sharedMemory) &&
+        sharedMemory->write(data.size(), [&data](uint8_t* buffer) { std::memcpy(buffer, data.data(), data.size()); }, bytes)) {
+        return bytes;
+    }
+#endif
+    if (data.size() < COPY_THRESHOLD) {
+        return zenoh::Bytes(static_cast<const std::string&>(data));
+    }
+    return zenoh::Bytes(std::move(data));
+}
+
+// Arena reset for each use, whose initial block grows to the high-water mark,
+// so that steady-state messages are built on it without allocating.
+class MessageArena {
+public:
+    // Resets the arena, or replaces it with a larger one if the last use
+    // overflowed its initial block. Messages of the last use are destroyed.
+    google::protobuf::Arena& next() {
+        if (arena && arena->SpaceAllocated() <= baseline) {
+            arena->Reset();
+            return *arena;
+        }
+        size_t size = arena ? std::max(2 * blockSize, static_cast<size_t>(arena->SpaceAllocated())) : INITIAL_ARENA_SIZE;
+        arena.reset();
+        block.reset(new char[size]);
+        blockSize = size;
+        google::protobuf::ArenaOptions options;
+        options.initial_block = block.get();
+        options.initial_block_size = size;
+        arena = std::make_unique<google::protobuf::Arena>(options);
+        baseline = arena->SpaceAllocated();
+        return *arena;
+    }
+
+private:
+    std::unique_ptr<char[]> block;
+    size_t blockSize = 0;
+    uint64_t baseline = 0;
+    std::unique_ptr<google::protobuf::Arena> arena;
+};
+
+// Message kept on a MessageArena of its own. Clearing it resets the arena, so
+// that refilling it does not allocate, except for the buffers of string and
+// bytes fields.
+template <typename Message>
+class ArenaMessage {
+public:
+    ArenaMessage() {
+        Clear();
+    }
+
+    ArenaMessage(const ArenaMessage&) = delete;
+    ArenaMessage& operator=(const ArenaMessage&) = delete;
+
+    void Clear() {
+        message = google::protobuf::Arena::CreateMessage<Message>(&arena.next());
+    }
+
+    Message& operator*() {
+        return *message;
+    }
+
+    Message* operator->() {
+        return message;
+    }
+
+private:
+    MessageArena arena;
+    Message* message;
+};
+
+} // namespace payload
+
+#endif // PAYLOAD_HPP
@@ -0,0 +1,160 @@
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+
+#include <atomic>
+#include <cstdint>
+
+
+// Concurrent registry of objects addressed by generation-tagged handles.
+//
+// Slots are allocated in chunks that are never moved or freed, so lookups are
+// a bounds check and two loads, without locking. The generation of a slot is
+// odd while it is in use and is bumped when the slot is removed, which makes
+// the handles of removed objects stale. Free slots are kept in a lock-free
+// (Treiber) stack whose head is tagged against ABA.
+//
+// The objects themselves are reused: a removed slot keeps its object, which
+// is handed to the next insert. Concurrent access to the contents of one
+// object must be synchronized by the caller.
+template <typename T>
+class Registry {
+public:
+    static const uint32_t SLOT_BITS = 16;
+    static const uint32_t CHUNK_SIZE = 256;
+    static const uint32_t CAPACITY = 1u << SLOT_BITS;
+
+    Registry() {
+        for (auto& chunk : chunks) {
+            chunk.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~Registry() {
+        for (auto& chunk : chunks) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    Registry(const Registry&) = delete;
+    Registry& operator=(const Registry&) = delete;
+
+    // Reserves a slot, lets init fill its object and then publishes it.
+    // Returns the handle, or -1 if the registry is full.
+    template <typename Init>
+    int32_t insert(Init&& init) {
+        uint32_t index;
+        if (!popFree(index) && !allocate(index)) {
+            return -1;
+        }
+        Slot& slot = slotAt(index);
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed) + 1;
+        init(slot.value);
+        slot.generation.store(generation, std::memory_order_release);
+        return makeHandle(index, generation);
+    }
+
+    // Returns the object of a handle, or nullptr if the handle is stale or invalid.
+    T* get(int32_t handle) {
+        Slot* slot = find(handle);
+        if (!slot || !matches(slot->generation.load(std::memory_order_acquire), handle)) {
+            return nullptr;
+        }
+        return &slot->value;
+    }
+
+    // Invalidates a handle and releases its slot. Returns false if the handle
+    // was already stale.
+    bool remove(int32_t handle) {
+        Slot* slot = find(handle);
+        if (!slot) {
+            return false;
+        }
+        uint32_t generation = slot->generation.load(std::memory_order_acquire);
+        if (!matches(generation, handle) ||
+            !slot->generation.compare_exchange_strong(generation, generation + 1, std::memory_order_acq_rel)) {
+            return false;
+        }
+        pushFree(static_cast<uint32_t>(handle) & (CAPACITY - 1));
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> generation{0};
+        std::atomic<uint32_t> nextFree{0};
+        T value;
+    };
+
+    static const uint32_t GENERATION_MASK = (1u << (31 - SLOT_BITS)) - 1;
+    static const uint32_t CHUNK_COUNT = CAPACITY / CHUNK_SIZE;
+
+    static int32_t makeHandle(uint32_t index, uint32_t generation) {
+        return static_cast<int32_t>(((generation & GENERATION_MASK) << SLOT_BITS) | index);
+    }
+
+    static bool matches(uint32_t generation, int32_t handle) {
+        return (generation & 1) && (generation & GENERATION_MASK) == (static_cast<uint32_t>(handle) >> SLOT_BITS);
+    }
+
+    Slot& slotAt(uint32_t index) {
+        return chunks[index / CHUNK_SIZE].load(std::memory_order_acquire)[index % CHUNK_SIZE];
+    }
+
+    Slot* find(int32_t handle) {
+        if (handle < 0) {
+            return nullptr;
+        }
+        uint32_t index = static_cast<uint32_t>(handle) & (CAPACITY - 1);
+        Slot* chunk = chunks[index / CHUNK_SIZE].load(std::memory_order_acquire);
+        return chunk ? &chunk[index % CHUNK_SIZE] : nullptr;
+    }
+
+    bool allocate(uint32_t& index) {
+        index = nextSlot.fetch_add(1, std::memory_order_relaxed);
+        if (index >= CAPACITY) {
+            nextSlot.store(CAPACITY, std::memory_order_relaxed);
+            return false;
+        }
+        std::atomic<Slot*>& chunk = chunks[index / CHUNK_SIZE];
+        if (!chunk.load(std::memory_order_acquire)) {
+            Slot* expected = nullptr;
+            Slot* allocated = new Slot[CHUNK_SIZE];
+            if (!chunk.compare_exchange_strong(expected, allocated, std::memory_order_acq_rel)) {
+                delete[] allocated;
+            }
+        }
+        return true;
+    }
+
+    // The head packs an ABA tag (high 32 bits) and the index + 1 of the top
+    // slot (low 32 bits, 0 when empty).
+    bool popFree(uint32_t& index) {
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(head) != 0) {
+            index = static_cast<uint32_t>(head) - 1;
+            uint32_t next = slotAt(index).nextFree.load(std::memory_order_relaxed);
+            uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+            if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void pushFree(uint32_t index) {
+        Slot& slot = slotAt(index);
+        uint64_t head = freeHead.load(std::memory_order_relaxed);
+        uint64_t newHead;
+        do {
+            slot.nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | (index + 1);
+        } while (!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    std::atomic<Slot*> chunks[CHUNK_COUNT];
+    std::atomic<uint32_t> nextSlot{0};
+    std::atomic<uint64_t> freeHead{0};
+};
+
+#endif // REGISTRY_HPP
@@ -0,0 +1,223 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+
+// Call statistics shared by the server and the Liaison FMU. Everything is
+// recorded with relaxed atomics, so statistics can be read while calls run.
+
+namespace stats {
+
+inline uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Heap allocations made by the calling thread. They are counted by the
+// operator new of builds with LIAISON_COUNT_ALLOCATIONS, and are 0 otherwise.
+#ifdef LIAISON_COUNT_ALLOCATIONS
+extern thread_local uint64_t threadAllocations;
+
+inline uint64_t allocations() {
+    return threadAllocations;
+}
+#else
+inline uint64_t allocations() {
+    return 0;
+}
+#endif
+
+inline uint32_t mostSignificantBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    uint32_t bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+// Latency histogram in nanoseconds with HDR-style buckets: each power of two
+// is split in SUB_BUCKETS linear buckets, so a recorded value is off by less
+// than 1/SUB_BUCKETS. Values above 2^MAX_BITS ns (about 68 s) are clamped.
+class Histogram {
+public:
+    static const uint32_t SUB_BUCKET_BITS = 3;
+    static const uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static const uint32_t MAX_BITS = 36;
+    static const uint32_t BUCKETS = SUB_BUCKETS * (MAX_BITS - SUB_BUCKET_BITS + 1);
+
+    void record(uint64_t value) {
+        buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t count() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    // Highest value of the bucket holding the given percentile (0 to 100).
+    uint64_t percentile(double percentile) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(percentile / 100.0 * n + 0.5));
+        uint64_t cumulative = 0;
+        for (uint32_t i = 0; i < BUCKETS; ++i) {
+            cumulative += buckets[i].load(std::memory_order_relaxed);
+            if (cumulative >= target) {
+                return std::min(highestValue(i), maximum.load(std::memory_order_relaxed));
+            }
+        }
+        return maximum.load(std::memory_order_relaxed);
+    }
+
+    nlohmann::json toJson() const {
+        uint64_t n = count();
+        return {
+            {"count", n},
+            {"meanNs", n ? sum.load(std::memory_order_relaxed) / n : 0},
+            {"p50Ns", percentile(50)},
+            {"p90Ns", percentile(90)},
+            {"p99Ns", percentile(99)},
+            {"p999Ns", percentile(99.9)},
+            {"maxNs", maximum.load(std::memory_order_relaxed)}
+        };
+    }
+
+private:
+    static uint32_t bucketIndex(uint64_t value) {
+        value = std::min(value, (uint64_t(1) << MAX_BITS) - 1);
+        if (value < SUB_BUCKETS) {
+            return static_cast<uint32_t>(value);
+        }
+        uint32_t shift = mostSignificantBit(value) - SUB_BUCKET_BITS;
+        return SUB_BUCKETS * shift + static_cast<uint32_t>(value >> shift);
+    }
+
+    static uint64_t highestValue(uint32_t index) {
+        if (index < 2 * SUB_BUCKETS) {
+            return index;
+        }
+        uint32_t shift = index / SUB_BUCKETS - 1;
+        uint64_t top = index - SUB_BUCKETS * shift;
+        return (top << shift) + (uint64_t(1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> buckets[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maximum{0};
+};
+
+// Calls of one function: counters and one histogram per phase of a call.
+template <size_t N_PHASES>
+struct CallStats {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> allocations[N_PHASES] = {};
+    Histogram phases[N_PHASES];
+
+    void record(const uint64_t (&durations)[N_PHASES], size_t in, size_t out) {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        bytesIn.fetch_add(in, std::memory_order_relaxed);
+        bytesOut.fetch_add(out, std::memory_order_relaxed);
+        for (size_t i = 0; i < N_PHASES; ++i) {
+            phases[i].record(durations[i]);
+        }
+    }
+
+    void recordAllocations(const uint64_t (&counts)[N_PHASES]) {
+        for (size_t i = 0; i < N_PHASES; ++i) {
+            allocations[i].fetch_add(counts[i], std::memory_order_relaxed);
+        }
+    }
+
+    nlohmann::json toJson(const char* const (&phaseNames)[N_PHASES]) const {
+        nlohmann::json result = {
+            {"calls", calls.load(std::memory_order_relaxed)},
+            {"bytesIn", bytesIn.load(std::memory_order_relaxed)},
+            {"bytesOut", bytesOut.load(std::memory_order_relaxed)}
+        };
+        for (size_t i = 0; i < N_PHASES; ++i) {
+            result[phaseNames[i]] = phases[i].toJson();
+        }
+#ifdef LIAISON_COUNT_ALLOCATIONS
+        nlohmann::json counts = nlohmann::json::object();
+        for (size_t i = 0; i < N_PHASES; ++i) {
+            counts[phaseNames[i]] = allocations[i].load(std::memory_order_relaxed);
+        }
+        result["allocations"] = counts;
+#endif
+        return result;
+    }
+};
+
+// Statistics of each function, by index, allocated on first call.
+template <size_t N_FUNCTIONS, size_t N_PHASES>
+class CallStatsTable {
+public:
+    CallStatsTable() {
+        for (auto& entry : entries) {
+            entry.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~CallStatsTable() {
+        for (auto& entry : entries) {
+            delete entry.load(std::memory_order_relaxed);
+        }
+    }
+
+    CallStatsTable(const CallStatsTable&) = delete;
+    CallStatsTable& operator=(const CallStatsTable&) = delete;
+
+    CallStats<N_PHASES>& get(size_t function) {
+        CallStats<N_PHASES>* stats = entries[function].load(std::memory_order_acquire);
+        if (!stats) {
+            CallStats<N_PHASES>* allocated = new CallStats<N_PHASES>();
+            if (entries[function].compare_exchange_strong(stats, allocated, std::memory_order_acq_rel)) {
+                stats = allocated;
+            } else {
+                delete allocated;
+            }
+        }
+        return *stats;
+    }
+
+    // Functions that were never called are left out.
+    template <typename Names>
+    nlohmann::json toJson(const Names& functionNames, const char* const (&phaseNames)[N_PHASES]) const {
+        nlohmann::json result = nlohmann::json::object();
+        for (size_t i = 0; i < N_FUNCTIONS; ++i) {
+            const CallStats<N_PHASES>* stats = entries[i].load(std::memory_order_acquire);
+            if (stats) {
+                result[std::string(functionNames[i])] = stats->toJson(phaseNames);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::atomic<CallStats<N_PHASES>*> entries[N_FUNCTIONS];
+};
+
+} // namespace stats
+
+#endif // STATS_HPP
@@ -9,6 +9,7 @@
 #include <cstdio>
 #include <stdexcept>
 #include <iostream>
+#include <regex>
 #include "utils.hpp"
 
 
@@ -110,4 +111,59 @@ void addFileToFmu(zip_t* zipArchive, const std::string& filePath, const std::str
         zip_source_free(source);
         throw std::runtime_error(zip_strerror(zipArchive));
     }
-}
\ No newline at end of file
+}
+
+std::string readModelDescription(const std::string& modelDescriptionPath) {
+    std::ifstream file(modelDescriptionPath);
+    if (!file) {
+        std::ostringstream oss;
+        oss << "Failed to open model description at: " << modelDescriptionPath;
+        throw std::runtime_error(oss.str());
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+std::string findAttribute(const std::string& text, const std::string& attribute) {
+    std::smatch match;
+    std::regex pattern("\\b" + attribute + "\\s*=\\s*\"([^\"]*)\"");
+    if (std::regex_search(text, match, pattern)) {
+        return match[1].str();
+    }
+    return "";
+}
+
+// Returns the value of the first occurrence of an attribute in the model
+// description, or an empty string if it is not present.
+std::string readModelDescriptionAttribute(const std::string& modelDescriptionPath, const std::string& attribute) {
+    return findAttribute(readModelDescription(modelDescriptionPath), attribute);
+}
+
+// Returns the variables of the model description. Only the attributes of the
+// variable elements are read, not the type definitions.
+std::vector<ModelVariable> readModelVariables(const std::string& modelDescriptionPath) {
+    std::string text = readModelDescription(modelDescriptionPath);
+    std::regex pattern("<(Float32|Float64|Int8|UInt8|Int16|UInt16|Int32|UInt32|Int64|UInt64|Boolean|String|Binary|Clock)\\s([^>]*?)(/?)>");
+    std::vector<ModelVariable> variables;
+    for (std::sregex_iterator it(text.begin(), text.end(), pattern), end; it != end; ++it) {
+        const std::smatch& match = *it;
+        std::string attributes = match[2].str();
+        std::string valueReference = findAttribute(attributes, "valueReference");
+        if (valueReference.empty()) {
+            continue;
+        }
+        ModelVariable variable;
+        variable.type = match[1].str();
+        variable.valueReference = static_cast<uint32_t>(std::stoul(valueReference));
+        variable.causality = findAttribute(attributes, "causality");
+        variable.array = false;
+        if (match[3].length() == 0) {
+            size_t start = match.position(0) + match.length(0);
+            size_t close = text.find("</" + variable.type + ">", start);
+            variable.array = text.find("<Dimension", start) < close;
+        }
+        variables.push_back(variable);
+    }
+    return variables;
+}
@@ -2,7 +2,10 @@
 #define FMI3LOGGING_HPP
 
 
+#include <cstdint>
 #include <fstream>
+#include <string>
+#include <vector>
 
 
 #include "fmi3Functions.h"
@@ -16,4 +19,17 @@ std::string unzipFmu(const std::string& fmuPath);
 
 void addFileToFmu(zip_t* zipArchive, const std::string& filePath, const std::string& archiveName);
 
+std::string readModelDescriptionAttribute(const std::string& modelDescriptionPath, const std::string& attribute);
+
+// A variable of the model description: its element (e.g. "Float64"), value
+// reference and causality. Arrays have dimensions.
+struct ModelVariable {
+    std::string type;
+    uint32_t valueReference;
+    std::string causality;
+    bool array;
+};
+
+std::vector<ModelVariable> readModelVariables(const std::string& modelDescriptionPath);
+
 #endif // FMI3LOGGING_HPP